@@ -0,0 +1,47 @@
+#version 440 core
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) writeonly buffer SortKeys {
+    uint keys[];
+};
+layout(std430, binding = 1) writeonly buffer SortOrder {
+    uint order[];
+};
+layout(std430, binding = 2) readonly buffer Boards {
+    vec4 boards[];
+};
+layout(std430, binding = 2) readonly buffer HalfBoards {
+    uvec2 halfBoards[];
+};
+
+uniform bool halfInstances;
+uniform int boardCount;
+uniform int sortCount;
+uniform vec3 sortPoint;
+
+vec3 loadPosition(uint i) {
+    if (halfInstances) {
+        uvec2 bits = halfBoards[i];
+        return vec3(unpackHalf2x16(bits.x), unpackHalf2x16(bits.y).x);
+    }
+    return boards[i].xyz;
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uint(sortCount)) {
+        return;
+    }
+
+    /* Inverted squared distance bits sort the farthest billboard first
+     * Padding keys sort after every real billboard */
+    if (i < uint(boardCount)) {
+        vec3 delta = loadPosition(i) - sortPoint;
+        keys[i] = ~floatBitsToUint(dot(delta, delta));
+    }
+    else {
+        keys[i] = 0xFFFFFFFFu;
+    }
+    order[i] = i;
+}
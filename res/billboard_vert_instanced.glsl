@@ -1,28 +1,62 @@
-#version 330 core
+#version 440 core
 
 layout(location = 0) in vec3 vertPos;
 layout(location = 1) in vec3 vertNor;
-layout(location = 2) in vec3 boardPosition;
-layout(location = 3) in float boardScale;
+layout(location = 2) in vec4 boardInstance;
 
 uniform mat4 P;
 uniform mat4 V;
 uniform mat4 Vi;
 
 uniform vec3 volumePosition;
+uniform float fluffiness;
+
+/* GPU sorted billboards are fetched through the sorted order buffer */
+uniform bool gpuSorted;
+uniform bool halfInstances;
+layout(std430, binding = 1) readonly buffer SortOrder {
+    uint order[];
+};
+layout(std430, binding = 2) readonly buffer Boards {
+    vec4 boards[];
+};
+layout(std430, binding = 2) readonly buffer HalfBoards {
+    uvec2 halfBoards[];
+};
+
+/* Cached lighting is keyed by each billboard's stable id rather than its sorted slot */
+uniform bool cachedLight;
+layout(std430, binding = 7) readonly buffer BoardIds {
+    uint boardIds[];
+};
 
 out vec3 fragPos;
 out vec3 fragNor;
 out vec2 fragTex;
 flat out vec3 center;
 flat out float scale;
+flat out uint boardId;
+
+vec4 loadBoard(uint i) {
+    if (halfInstances) {
+        uvec2 bits = halfBoards[i];
+        return vec4(unpackHalf2x16(bits.x), unpackHalf2x16(bits.y));
+    }
+    return boards[i];
+}
 
 void main() {
-    vec3 finalPos = volumePosition + boardPosition;
+    uint boardIndex = gpuSorted ? order[gl_InstanceID] : uint(gl_InstanceID);
+    vec4 board = gpuSorted ? loadBoard(boardIndex) : boardInstance;
+    boardId = cachedLight ? boardIds[boardIndex] : boardIndex;
+    vec3 instancePosition = board.xyz;
+    float instanceScale = board.w * fluffiness;
+
+    vec3 finalPos = volumePosition + instancePosition;
     mat4 M = mat4(1.f);
-    M[0][0] = boardScale; 
-    M[1][1] = boardScale; 
-    M[2][2] = boardScale; 
+    M[0][0] = instanceScale; 
+    M[1][1] = instanceScale; 
+    M[2][2] = instanceScale; 
     M[3][0] = finalPos.x;
     M[3][1] = finalPos.y;
     M[3][2] = finalPos.z;
@@ -34,5 +68,5 @@ void main() {
     fragNor = mat3(transpose(inverse(M * Vi))) * vertNor;
     fragTex = (vertPos.xy + 1) / 2.f;
     center = finalPos;
-    scale = boardScale;
+    scale = instanceScale;
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#version 440 core
+
+#define BLOCK_SIZE 512
+
+layout(local_size_x = 256) in;
+
+layout(std430, binding = 0) buffer SortKeys {
+    uint keys[];
+};
+layout(std430, binding = 1) buffer SortOrder {
+    uint order[];
+};
+
+uniform int stage;
+uniform int passSize;
+uniform bool localPasses;
+
+shared uint sharedKeys[BLOCK_SIZE];
+shared uint sharedOrder[BLOCK_SIZE];
+
+/* First element of the pair compared by this thread */
+uint pairIndex(uint t, uint j) {
+    return 2u * j * (t / j) + (t % j);
+}
+
+void main() {
+    uint k = uint(stage);
+    uint j = uint(passSize);
+
+    /* Single compare-and-swap in global memory */
+    if (!localPasses) {
+        uint i = pairIndex(gl_GlobalInvocationID.x, j);
+        uint l = i + j;
+        bool ascending = (i & k) == 0u;
+        uint a = keys[i];
+        uint b = keys[l];
+        if ((a > b) == ascending) {
+            keys[i] = b;
+            keys[l] = a;
+            uint tmp = order[i];
+            order[i] = order[l];
+            order[l] = tmp;
+        }
+        return;
+    }
+
+    /* All remaining passes of this stage fit in one block - finish them in shared memory */
+    uint base = gl_WorkGroupID.x * BLOCK_SIZE;
+    uint t = gl_LocalInvocationID.x;
+    sharedKeys[t] = keys[base + t];
+    sharedKeys[t + BLOCK_SIZE/2] = keys[base + t + BLOCK_SIZE/2];
+    sharedOrder[t] = order[base + t];
+    sharedOrder[t + BLOCK_SIZE/2] = order[base + t + BLOCK_SIZE/2];
+    memoryBarrierShared();
+    barrier();
+
+    for (; j > 0u; j >>= 1) {
+        uint i = pairIndex(t, j);
+        uint l = i + j;
+        bool ascending = ((base + i) & k) == 0u;
+        uint a = sharedKeys[i];
+        uint b = sharedKeys[l];
+        if ((a > b) == ascending) {
+            sharedKeys[i] = b;
+            sharedKeys[l] = a;
+            uint tmp = sharedOrder[i];
+            sharedOrder[i] = sharedOrder[l];
+            sharedOrder[l] = tmp;
+        }
+        memoryBarrierShared();
+        barrier();
+    }
+
+    keys[base + t] = sharedKeys[t];
+    keys[base + t + BLOCK_SIZE/2] = sharedKeys[t + BLOCK_SIZE/2];
+    order[base + t] = sharedOrder[t];
+    order[base + t + BLOCK_SIZE/2] = sharedOrder[t + BLOCK_SIZE/2];
+}
@@ -0,0 +1,64 @@
+#version 440 core
+
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+
+layout(std430, binding = 2) readonly buffer Boards {
+    vec4 boards[];
+};
+layout(std430, binding = 2) readonly buffer HalfBoards {
+    uvec2 halfBoards[];
+};
+
+/* Cascade texture, addressed toroidally by world voxel coordinate */
+layout(binding=0, r8) uniform writeonly image3D cascade;
+uniform int voxelDim;
+uniform float voxelSize;
+
+/* World voxel region [regionMin, regionMin + regionSize) */
+uniform ivec3 regionMin;
+uniform ivec3 regionSize;
+
+uniform bool halfInstances;
+uniform int boardCount;
+uniform vec3 volumePosition;
+uniform float fluffiness;
+uniform vec3 lightDir;
+
+vec4 loadBoard(uint i) {
+    if (halfInstances) {
+        uvec2 bits = halfBoards[i];
+        return vec4(unpackHalf2x16(bits.x), unpackHalf2x16(bits.y));
+    }
+    return boards[i];
+}
+
+bool insideCloud(vec3 pos) {
+    for (int i = 0; i < boardCount; i++) {
+        vec4 board = loadBoard(i);
+        vec3 delta = pos - (volumePosition + board.xyz);
+        float radius = board.w * fluffiness;
+        if (dot(delta, delta) < radius * radius) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void main() {
+    ivec3 offset = ivec3(gl_GlobalInvocationID);
+    if (any(greaterThanEqual(offset, regionSize))) {
+        return;
+    }
+    ivec3 worldVoxel = regionMin + offset;
+    vec3 pos = (vec3(worldVoxel) + 0.5) * voxelSize;
+
+    /* Light-facing shell of the cloud - inside a sphere with open space toward the light */
+    float value = 0.f;
+    if (insideCloud(pos) && !insideCloud(pos + lightDir * voxelSize)) {
+        value = 1.f;
+    }
+
+    /* Every region voxel is written so no separate clear is needed */
+    ivec3 texel = ((worldVoxel % voxelDim) + voxelDim) % voxelDim;
+    imageStore(cascade, texel, vec4(value));
+}
\ No newline at end of file
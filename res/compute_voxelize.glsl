@@ -0,0 +1,102 @@
+#version 440 core
+
+#define BRICK_SIZE 8
+
+/* One work group per billboard sphere, threads stride over its light-space footprint */
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(std430, binding = 2) readonly buffer Boards {
+    vec4 boards[];
+};
+layout(std430, binding = 2) readonly buffer HalfBoards {
+    uvec2 halfBoards[];
+};
+
+layout(binding=0, r8) uniform image3D volume;
+layout(binding=1, r32ui) uniform uimage2D lightDepth;
+uniform int voxelDim;
+uniform vec2 xBounds;
+uniform vec2 yBounds;
+uniform vec2 zBounds;
+uniform float stepSize;
+
+uniform bool halfInstances;
+uniform vec3 volumePosition;
+uniform float fluffiness;
+
+uniform mat4 lightV;
+uniform mat4 lightVi;
+uniform vec2 lightMin;
+uniform float lightTexelSize;
+uniform int lightMapSize;
+
+/* First pass keeps the nearest surface per light texel, second pass writes it */
+uniform bool resolvePass;
+
+vec4 loadBoard(uint i) {
+    if (halfInstances) {
+        uvec2 bits = halfBoards[i];
+        return vec4(unpackHalf2x16(bits.x), unpackHalf2x16(bits.y));
+    }
+    return boards[i];
+}
+
+#include "voxel_common.glsl"
+
+/* Sparse volumes write through the brick indirection into the atlas */
+layout(binding=2, r32ui) uniform readonly uimage3D brickIndirection;
+uniform bool brickMap;
+uniform int atlasBricks;
+
+void storeVoxel(ivec3 voxelIndex, vec4 value) {
+    if (!brickMap) {
+        imageStore(volume, voxelIndex, value);
+        return;
+    }
+    if (any(lessThan(voxelIndex, ivec3(0))) || any(greaterThanEqual(voxelIndex, ivec3(voxelDim)))) {
+        return;
+    }
+    uint slot = imageLoad(brickIndirection, voxelIndex / BRICK_SIZE).r;
+    if (slot == 0) {
+        return;
+    }
+    slot--;
+    ivec3 atlasBrick = ivec3(slot % atlasBricks, (slot / atlasBricks) % atlasBricks, slot / (atlasBricks * atlasBricks));
+    imageStore(volume, atlasBrick * BRICK_SIZE + voxelIndex % BRICK_SIZE, value);
+}
+
+void main() {
+    vec4 board = loadBoard(gl_WorkGroupID.x);
+    vec3 center = volumePosition + board.xyz;
+    float radius = board.w * fluffiness;
+    vec3 lightCenter = (lightV * vec4(center, 1)).xyz;
+
+    /* Light-space texels covered by the sphere */
+    ivec2 minTexel = max(ivec2(floor((lightCenter.xy - radius - lightMin) / lightTexelSize)), ivec2(0));
+    ivec2 maxTexel = min(ivec2(ceil((lightCenter.xy + radius - lightMin) / lightTexelSize)), ivec2(lightMapSize - 1));
+
+    for (int y = minTexel.y + int(gl_LocalInvocationID.y); y <= maxTexel.y; y += int(gl_WorkGroupSize.y)) {
+        for (int x = minTexel.x + int(gl_LocalInvocationID.x); x <= maxTexel.x; x += int(gl_WorkGroupSize.x)) {
+            vec2 lightPos = lightMin + (vec2(x, y) + 0.5) * lightTexelSize;
+
+            /* Spherical distance - 1 at center of billboard, 0 at edges */
+            float sphereContrib = distance(lightCenter.xy, lightPos) / radius;
+            sphereContrib = sqrt(max(0, 1 - sphereContrib * sphereContrib));
+            if (sphereContrib < 0.01f) {
+                continue;
+            }
+
+            /* Light looks down -z so the light-facing surface has the larger z */
+            float surfaceZ = lightCenter.z + radius * sphereContrib;
+            uint depthBits = floatBitsToUint(max(0, -surfaceZ));
+            ivec2 texel = ivec2(x, y);
+            if (!resolvePass) {
+                imageAtomicMin(lightDepth, texel, depthBits);
+            }
+            else if (imageLoad(lightDepth, texel).r == depthBits) {
+                vec3 worldPos = (lightVi * vec4(lightPos, surfaceZ, 1)).xyz;
+                storeVoxel(calculateVoxelIndex(worldPos), vec4(1));
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -1,12 +1,14 @@
 #version 440 core
 
 #define PI 3.14159265359f
+#define BRICK_SIZE 8
 
 in vec3 fragPos;
 in vec3 fragNor;
 in vec2 fragTex;
 flat in vec3 center;
 flat in float scale;
+flat in uint boardId;
 
 uniform mat4 V;
 uniform vec3 lightPos;
@@ -19,6 +21,44 @@ uniform vec2 yBounds;
 uniform vec2 zBounds;
 uniform sampler3D volumeTexture;
 
+/* Sparse volume - brick indirection into an atlas with per-brick mips */
+uniform bool brickMap;
+uniform usampler3D brickIndirection;
+uniform sampler3D brickAtlas;
+uniform int atlasBricks;
+uniform int atlasLevels;
+
+/* Sparse voxel octree - x first of 8 children (0 none), y filtered density bits */
+uniform bool octree;
+uniform int octreeDepth;
+layout(std430, binding = 3) readonly buffer OctreeNodes {
+    uvec2 nodes[];
+};
+
+/* Camera-centred clipmap - equal voxel counts, each cascade doubling the last's voxel size
+ * Cascades repeat so world voxel coordinates address them toroidally */
+uniform bool clipmap;
+uniform int clipCascades;
+uniform float clipVoxelSize;
+uniform vec3 clipCenter;
+uniform sampler3D clipmap0;
+uniform sampler3D clipmap1;
+uniform sampler3D clipmap2;
+uniform sampler3D clipmap3;
+
+/* Precomputed transmittance toward the light, aligned with the light's projection */
+uniform bool precomputedLight;
+uniform sampler3D transmittance;
+uniform mat4 transmittancePV;
+
+/* Per-billboard lighting cache - cone traces at a latitude-longitude grid of sphere points */
+#define CACHE_ROWS 4
+#define CACHE_COLUMNS 4
+uniform bool cachedLight;
+layout(std430, binding = 6) readonly buffer LightingCache {
+    float lightCache[];
+};
+
 uniform bool doConeTrace;
 uniform int vctSteps;
 uniform float vctConeAngle;
@@ -29,6 +69,12 @@ uniform float vctDownScaling;
 uniform bool doNoise;
 uniform sampler3D noiseMap;
 uniform vec3 octaveOffsets;
+
+/* Pre-summed octaves, normalized by their total amplitude and scrolled by the wind */
+uniform bool bakedNoise;
+uniform sampler3D bakedNoiseMap;
+uniform float bakedAmplitude;
+uniform vec3 noiseScroll;
 uniform float stepSize;
 uniform float noiseOpacity;
 uniform int numOctaves;
@@ -41,24 +87,90 @@ uniform int maxNoiseSteps;
 uniform float minNoiseColor;
 uniform float noiseColorScale;
 
-out vec4 color;
+/* Specialized variants fix these at compile time so dead paths drop out and
+ * loops get constant bounds, otherwise they fall back to the uniforms */
+#ifndef SHOW_QUAD
+#define SHOW_QUAD showQuad
+#endif
+#ifndef DO_NOISE
+#define DO_NOISE doNoise
+#endif
+#ifndef DO_CONE_TRACE
+#define DO_CONE_TRACE doConeTrace
+#endif
+#ifndef BAKED_NOISE
+#define BAKED_NOISE bakedNoise
+#endif
+#ifndef MAX_OCTAVES
+#define MAX_OCTAVES 16
+#endif
+#ifndef MAX_VCT_STEPS
+#define MAX_VCT_STEPS 32
+#endif
+
+layout(location = 0) out vec4 color;
 
-/* Linear map from aribtray box(?) in world space to 3D volume 
- * Voxel indices: [0, dimension - 1] */
-vec3 calculateVoxelLerp(vec3 pos) {
-    float rangeX = xBounds.y - xBounds.x;
-    float rangeY = yBounds.y - yBounds.x;
-    float rangeZ = zBounds.y - zBounds.x;
+/* Nearest view depth of visible cloud, only read by reduced resolution passes */
+#define FAR_DEPTH 1e30
+layout(location = 1) out float cloudDepth;
 
-    float x = voxelDim * ((pos.x - xBounds.x) / rangeX);
-    float y = voxelDim * ((pos.y - yBounds.x) / rangeY);
-    float z = voxelDim * ((pos.z - zBounds.x) / rangeZ);
+#include "voxel_common.glsl"
 
-    return vec3(x, y, z);
+/* Density of the octree node a number of levels below the root */
+float octreeDensity(ivec3 voxel, int levels) {
+    uint node = 0;
+    for (int i = 0; i < levels; i++) {
+        uint child = nodes[node].x;
+        if (child == 0) {
+            return 0.f;
+        }
+        uvec3 octant = (uvec3(voxel) >> uint(octreeDepth - 1 - i)) & 1u;
+        node = child + octant.x + octant.y * 2 + octant.z * 4;
+    }
+    return uintBitsToFloat(nodes[node].y);
 }
 
-ivec3 calculateVoxelIndex(vec3 pos) {
-    return ivec3(calculateVoxelLerp(pos));
+/* Octree level matching the cone's mip, blended between the two nearest levels */
+float sampleOctree(vec3 uvw, float lod) {
+    vec3 voxel = uvw * voxelDim;
+    if (any(lessThan(voxel, vec3(0))) || any(greaterThanEqual(voxel, vec3(voxelDim)))) {
+        return 0.f;
+    }
+    lod = clamp(lod, 0.f, float(octreeDepth));
+    int fineLevel = int(floor(lod));
+    int coarseLevel = min(fineLevel + 1, octreeDepth);
+    float fine = octreeDensity(ivec3(voxel), octreeDepth - fineLevel);
+    float coarse = octreeDensity(ivec3(voxel), octreeDepth - coarseLevel);
+    return mix(fine, coarse, lod - fineLevel);
+}
+
+/* Sample the volume at normalized coordinates
+ * Sparse samples are clamped inside their brick since bricks have no borders */
+float sampleVolume(sampler3D voxelTexture, vec3 uvw, float lod) {
+    if (octree) {
+        return sampleOctree(uvw, lod);
+    }
+    if (!brickMap) {
+        return textureLod(voxelTexture, uvw, lod).r;
+    }
+
+    vec3 voxel = uvw * voxelDim;
+    ivec3 brick = ivec3(floor(voxel / BRICK_SIZE));
+    if (any(lessThan(brick, ivec3(0))) || any(greaterThanEqual(brick * BRICK_SIZE, ivec3(voxelDim)))) {
+        return 0.f;
+    }
+    uint slot = texelFetch(brickIndirection, brick, 0).r;
+    if (slot == 0) {
+        return 0.f;
+    }
+    slot--;
+    ivec3 atlasBrick = ivec3(slot % atlasBricks, (slot / atlasBricks) % atlasBricks, slot / (atlasBricks * atlasBricks));
+
+    lod = clamp(lod, 0.f, float(atlasLevels - 1));
+    float margin = 0.5f * exp2(ceil(lod));
+    vec3 local = clamp(voxel - vec3(brick * BRICK_SIZE), vec3(margin), vec3(BRICK_SIZE - margin));
+    vec3 atlasUVW = (vec3(atlasBrick * BRICK_SIZE) + local) / float(atlasBricks * BRICK_SIZE);
+    return textureLod(brickAtlas, atlasUVW, lod).r;
 }
 
 float traceCone(sampler3D voxelTexture, vec3 position, vec3 direction, int steps, float coneAngle, float coneHeight) {
@@ -67,17 +179,99 @@ float traceCone(sampler3D voxelTexture, vec3 position, vec3 direction, int steps
     position /= voxelDim;
 
     float color = 0.f;
-    for (int i = 1; i <= steps; i++) {
+    for (int i = 1; i <= MAX_VCT_STEPS; i++) {
+        if (i > steps) {
+            break;
+        }
         float coneRadius = coneHeight * tan(coneAngle / 2.f);
         float lod = log2(max(1.f, 2.f * coneRadius));
-        vec4 sampleColor = textureLod(voxelTexture, position + coneHeight * direction, lod + vctLodOffset);
-        color += sampleColor.r * float(i)/(steps*vctDownScaling); // TODO : linear scaling
+        float sampleColor = sampleVolume(voxelTexture, position + coneHeight * direction, lod + vctLodOffset);
+        color += sampleColor * float(i)/(steps*vctDownScaling); // TODO : linear scaling
+        coneHeight += coneRadius;
+    }
+
+    return color;
+}
+
+/* Sampler arrays can't be indexed per fragment */
+float sampleCascade(int cascade, vec3 uvw, float lod) {
+    if (cascade == 0) {
+        return textureLod(clipmap0, uvw, lod).r;
+    }
+    if (cascade == 1) {
+        return textureLod(clipmap1, uvw, lod).r;
+    }
+    if (cascade == 2) {
+        return textureLod(clipmap2, uvw, lod).r;
+    }
+    return textureLod(clipmap3, uvw, lod).r;
+}
+
+/* Cone trace in finest cascade voxels
+ * Each sample uses the finest cascade that both contains it and is no finer than the cone */
+float traceClipmapCone(vec3 position, vec3 direction, int steps, float coneAngle, float coneHeight) {
+    direction = normalize(direction);
+    position /= clipVoxelSize;
+    vec3 center = clipCenter / clipVoxelSize;
+
+    float color = 0.f;
+    for (int i = 1; i <= MAX_VCT_STEPS; i++) {
+        if (i > steps) {
+            break;
+        }
+        float coneRadius = coneHeight * tan(coneAngle / 2.f);
+        float lod = log2(max(1.f, 2.f * coneRadius)) + vctLodOffset;
+        vec3 samplePos = position + coneHeight * direction;
+
+        /* Keep a voxel of margin from the cascade edge for filtering */
+        vec3 offset = abs(samplePos - center);
+        float dist = max(offset.x, max(offset.y, offset.z));
+        int cascade = int(ceil(log2(max(1.f, dist / (voxelDim / 2 - 1)))));
+        cascade = max(cascade, int(floor(max(lod, 0.f))));
+        if (cascade >= clipCascades) {
+            break;
+        }
+
+        float scale = exp2(float(cascade));
+        float sampleColor = sampleCascade(cascade, samplePos / (scale * voxelDim), max(lod - cascade, 0.f));
+        color += sampleColor * float(i)/(steps*vctDownScaling);
         coneHeight += coneRadius;
     }
 
     return color;
 }
 
+/* Single fetch replacing the cone trace toward the light */
+float lightTransmittance(vec3 position) {
+    vec4 ndc = transmittancePV * vec4(position, 1);
+    vec3 uvw = ndc.xyz / ndc.w * 0.5 + 0.5;
+    return textureLod(transmittance, uvw, 0).r;
+}
+
+/* Bilinear lookup of this billboard's cached points, wrapping around longitude */
+float cachedLighting(vec3 position) {
+    vec3 dir = normalize(position - center);
+    float theta = acos(clamp(dir.y, -1.f, 1.f));
+    float phi = atan(dir.z, dir.x);
+    if (phi < 0.f) {
+        phi += 2 * PI;
+    }
+
+    float v = clamp(theta / PI * CACHE_ROWS - 0.5, 0.f, float(CACHE_ROWS - 1));
+    float u = phi / (2 * PI) * CACHE_COLUMNS - 0.5;
+    int row0 = int(floor(v));
+    int row1 = min(row0 + 1, CACHE_ROWS - 1);
+    int col0 = (int(floor(u)) + CACHE_COLUMNS) % CACHE_COLUMNS;
+    int col1 = (col0 + 1) % CACHE_COLUMNS;
+    float fu = fract(u);
+    float fv = v - row0;
+
+    uint base = boardId * CACHE_ROWS * CACHE_COLUMNS;
+    float top = mix(lightCache[base + row0 * CACHE_COLUMNS + col0], lightCache[base + row0 * CACHE_COLUMNS + col1], fu);
+    float bottom = mix(lightCache[base + row1 * CACHE_COLUMNS + col0], lightCache[base + row1 * CACHE_COLUMNS + col1], fu);
+    return mix(top, bottom, fv);
+}
+
 float saturate(float x) {
     return clamp(x, 0, 1);
 }
@@ -101,12 +295,21 @@ bool raySphereIntersect(vec3 rO, vec3 rD, vec3 sO, float sR, inout float tnear,
 }
 
 vec4 noise3D(vec3 uv, int octaves) {
+    if (BAKED_NOISE) {
+        vec4 bakedVal = bakedAmplitude * texture(bakedNoiseMap, uv + noiseScroll);
+        bakedVal.a = abs(bakedVal.a);
+        return bakedVal;
+    }
+
     vec4 noiseVal = vec4(0, 0, 0, 0);
     vec4 octaveVal = vec4(0, 0, 0, 0);
     vec3 uvOffset;
     float freq = 1;
     float pers = 1;
-    for (int i = 0; i < octaves; i++) {
+    for (int i = 0; i < MAX_OCTAVES; i++) {
+        if (i >= octaves) {
+            break;
+        }
         uvOffset = uv + octaveOffsets[i];
         octaveVal = texture(noiseMap, uvOffset*freq);
         noiseVal += pers * octaveVal;
@@ -121,7 +324,7 @@ vec4 noise3D(vec3 uv, int octaves) {
 
 void main() {
     float radius = scale;
-    if (showQuad) {
+    if (SHOW_QUAD) {
         /* Spherical distance - 1 at center of billboard, 0 at edges */
         float sphereContrib = (distance(center, fragPos)/radius);
         sphereContrib = sqrt(max(0, 1 - sphereContrib * sphereContrib));
@@ -130,11 +333,12 @@ void main() {
             fragTex.x > 0.99f || fragTex.y > 0.99f) {
             color = vec4(1);
         }
+        cloudDepth = -(V * vec4(fragPos, 1)).z;
         return;
     }
 
     /* Sample noise texture */
-    if (doNoise) {
+    if (DO_NOISE) {
         vec3 viewRay = normalize(vec3(V[0][2], V[1][2], V[2][2]));
         float tnear, tfar;
         if (!raySphereIntersect(fragPos, viewRay, center, radius, tnear, tfar)) {
@@ -173,7 +377,7 @@ void main() {
         color = vec4(vec3(col), runningOpacity*alpha);
     }
 
-    if (doConeTrace) {
+    if (DO_CONE_TRACE) {
         /* Spherical distance - 1 at center of billboard, 0 at edges */
         float sphereContrib = (distance(center, fragPos)/radius);
         sphereContrib = sqrt(max(0, 1 - sphereContrib * sphereContrib));
@@ -188,15 +392,29 @@ void main() {
         /* Cone trace */
         vec3 voxelPosition = calculateVoxelLerp(pos);
         vec3 dir = lightPos - pos;
-        float indirect = traceCone(volumeTexture, voxelPosition, dir, vctSteps, vctConeAngle, vctConeInitialHeight);
+        float indirect;
+        if (precomputedLight) {
+            indirect = lightTransmittance(pos);
+        }
+        else if (cachedLight) {
+            indirect = cachedLighting(pos);
+        }
+        else if (clipmap) {
+            indirect = traceClipmapCone(pos, dir, vctSteps, vctConeAngle, vctConeInitialHeight);
+        }
+        else {
+            indirect = traceCone(volumeTexture, voxelPosition, dir, vctSteps, vctConeAngle, vctConeInitialHeight);
+        }
 
         /* Output */
-        if (doNoise) {
+        if (DO_NOISE) {
             color.rgb *= indirect; 
         }
         else {
             color = vec4(indirect);
         }
     }
+
+    cloudDepth = color.a > 0.01f ? -(V * vec4(fragPos, 1)).z : FAR_DEPTH;
 }
 
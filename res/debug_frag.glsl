@@ -3,10 +3,11 @@
 in vec3 fragPos;
 in vec2 fragTex;
 
-uniform sampler2D positionMap;
+uniform sampler2D lightDepthMap;
+uniform float clipDistance;
 
 out vec4 color;
 
 void main() {
-    color = texture(positionMap, fragTex);
+    color = vec4(vec3(texture(lightDepthMap, fragTex).r / clipDistance), 1);
 }
\ No newline at end of file
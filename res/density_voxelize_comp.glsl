@@ -0,0 +1,133 @@
+#version 440 core
+
+#define BRICK_SIZE 8
+
+/* Fixed point scale of accumulated density */
+#define DENSITY_ONE 256.0
+
+/* Accumulate pass - one work group per billboard sphere, threads stride over its light-space footprint
+ * Resolve pass - one thread per voxel */
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(std430, binding = 2) readonly buffer Boards {
+    vec4 boards[];
+};
+layout(std430, binding = 2) readonly buffer HalfBoards {
+    uvec2 halfBoards[];
+};
+
+layout(binding=0, r8) uniform image3D volume;
+layout(binding=1, r32ui) uniform uimage3D density;    // Region sized, indexed from regionMin
+uniform int voxelDim;
+uniform vec2 xBounds;
+uniform vec2 yBounds;
+uniform vec2 zBounds;
+uniform float stepSize;
+
+uniform bool halfInstances;
+uniform vec3 volumePosition;
+uniform float fluffiness;
+
+uniform mat4 lightV;
+uniform mat4 lightVi;
+uniform vec2 lightMin;
+uniform float lightTexelSize;
+uniform int lightMapSize;
+
+/* Density added per chord sample, corrects for samples landing in each voxel */
+uniform float sampleWeight;
+
+/* Level 0 voxels [regionMin, regionMax) being rewritten */
+uniform bool resolvePass;
+uniform ivec3 regionMin;
+uniform ivec3 regionMax;
+uniform float densityScale;
+
+vec4 loadBoard(uint i) {
+    if (halfInstances) {
+        uvec2 bits = halfBoards[i];
+        return vec4(unpackHalf2x16(bits.x), unpackHalf2x16(bits.y));
+    }
+    return boards[i];
+}
+
+#include "voxel_common.glsl"
+
+/* Sparse volumes write through the brick indirection into the atlas */
+layout(binding=2, r32ui) uniform readonly uimage3D brickIndirection;
+uniform bool brickMap;
+uniform int atlasBricks;
+
+void storeVoxel(ivec3 voxelIndex, vec4 value) {
+    if (!brickMap) {
+        imageStore(volume, voxelIndex, value);
+        return;
+    }
+    if (any(lessThan(voxelIndex, ivec3(0))) || any(greaterThanEqual(voxelIndex, ivec3(voxelDim)))) {
+        return;
+    }
+    uint slot = imageLoad(brickIndirection, voxelIndex / BRICK_SIZE).r;
+    if (slot == 0) {
+        return;
+    }
+    slot--;
+    ivec3 atlasBrick = ivec3(slot % atlasBricks, (slot / atlasBricks) % atlasBricks, slot / (atlasBricks * atlasBricks));
+    imageStore(volume, atlasBrick * BRICK_SIZE + voxelIndex % BRICK_SIZE, value);
+}
+
+/* Normalize accumulated density into opacity */
+void resolve() {
+    ivec3 voxelIndex = regionMin + ivec3(gl_GlobalInvocationID);
+    if (any(greaterThanEqual(voxelIndex, regionMax))) {
+        return;
+    }
+    uint bits = imageLoad(density, voxelIndex - regionMin).r;
+    if (bits == 0) {
+        return;
+    }
+    float value = 1 - exp(-densityScale * float(bits) / DENSITY_ONE);
+    storeVoxel(voxelIndex, vec4(value));
+}
+
+void main() {
+    if (resolvePass) {
+        resolve();
+        return;
+    }
+
+    vec4 board = loadBoard(gl_WorkGroupID.x);
+    vec3 center = volumePosition + board.xyz;
+    float radius = board.w * fluffiness;
+    vec3 lightCenter = (lightV * vec4(center, 1)).xyz;
+
+    /* Light-space texels covered by the sphere */
+    ivec2 minTexel = max(ivec2(floor((lightCenter.xy - radius - lightMin) / lightTexelSize)), ivec2(0));
+    ivec2 maxTexel = min(ivec2(ceil((lightCenter.xy + radius - lightMin) / lightTexelSize)), ivec2(lightMapSize - 1));
+
+    for (int y = minTexel.y + int(gl_LocalInvocationID.y); y <= maxTexel.y; y += int(gl_WorkGroupSize.y)) {
+        for (int x = minTexel.x + int(gl_LocalInvocationID.x); x <= maxTexel.x; x += int(gl_WorkGroupSize.x)) {
+            vec2 lightPos = lightMin + (vec2(x, y) + 0.5) * lightTexelSize;
+
+            /* Spherical distance - 1 at center of billboard, 0 at edges */
+            float sphereContrib = distance(lightCenter.xy, lightPos) / radius;
+            sphereContrib = sqrt(max(0, 1 - sphereContrib * sphereContrib));
+            if (sphereContrib < 0.01f) {
+                continue;
+            }
+
+            /* Walk the chord through the sphere, thicker toward the center */
+            uint weight = uint(sampleWeight * sphereContrib * DENSITY_ONE + 0.5);
+            if (weight == 0) {
+                continue;
+            }
+            float halfChord = radius * sphereContrib;
+            for (float z = -halfChord; z < halfChord; z += stepSize) {
+                vec3 worldPos = (lightVi * vec4(lightPos, lightCenter.z + z, 1)).xyz;
+                ivec3 voxelIndex = calculateVoxelIndex(worldPos);
+                if (all(greaterThanEqual(voxelIndex, regionMin)) && all(lessThan(voxelIndex, regionMax))) {
+                    imageAtomicAdd(density, voxelIndex - regionMin, weight);
+                }
+            }
+        }
+    }
+}
\ No newline at end of file
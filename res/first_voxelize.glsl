@@ -6,6 +6,7 @@ in vec3 fragNor;
 flat in vec3 center;
 flat in float scale;
 
+uniform mat4 V;
 uniform vec3 lightNearPlane;
 uniform float clipDistance;
 
@@ -18,23 +19,7 @@ uniform float stepSize;
 
 out vec4 color;
 
-/* Linear map from aribtray box(?) in world space to 3D volume 
- * Voxel indices: [0, dimension - 1] */
-vec3 calculateVoxelLerp(vec3 pos) {
-    float rangeX = xBounds.y - xBounds.x;
-    float rangeY = yBounds.y - yBounds.x;
-    float rangeZ = zBounds.y - zBounds.x;
-
-    float x = voxelDim * ((pos.x - xBounds.x) / rangeX);
-    float y = voxelDim * ((pos.y - yBounds.x) / rangeY);
-    float z = voxelDim * ((pos.z - zBounds.x) / rangeZ);
-
-	return vec3(x, y, z);
-}
-
-ivec3 calculateVoxelIndex(vec3 pos) {
-	return ivec3(calculateVoxelLerp(pos));
-}
+#include "voxel_common.glsl"
 
 void main() {
     float radius = scale;
@@ -57,8 +42,9 @@ void main() {
     //     imageStore(volume, voxelIndex, ivec4(0, 0, 0, 1));
     // }
 
-    /* Write nearest voxel position to position FBO */
+    /* Write nearest light-view depth to light depth map
+     * Billboards face the light so the position is recovered from this texel */
     vec3 worldPos = fragPos + dir * dist;
-    color = vec4(worldPos, 1);
+    color = vec4(-(V * vec4(worldPos, 1)).z);
     gl_FragDepth = distance(lightNearPlane, worldPos) / clipDistance;
 }
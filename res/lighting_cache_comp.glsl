@@ -0,0 +1,84 @@
+#version 440 core
+
+#define PI 3.14159265359f
+
+/* Points per billboard on a latitude-longitude grid */
+#define CACHE_ROWS 4
+#define CACHE_COLUMNS 4
+
+/* One work group per billboard slot, one thread per cached point
+ * Points are stored under the billboard's id so sorting doesn't invalidate them */
+layout(local_size_x = CACHE_COLUMNS, local_size_y = CACHE_ROWS) in;
+
+layout(std430, binding = 2) readonly buffer Boards {
+    vec4 boards[];
+};
+layout(std430, binding = 2) readonly buffer HalfBoards {
+    uvec2 halfBoards[];
+};
+layout(std430, binding = 7) readonly buffer BoardIds {
+    uint boardIds[];
+};
+layout(std430, binding = 6) writeonly buffer LightingCache {
+    float cache[];
+};
+
+uniform bool halfInstances;
+uniform vec3 volumePosition;
+uniform float fluffiness;
+uniform vec3 lightPos;
+
+uniform int voxelDim;
+uniform vec2 xBounds;
+uniform vec2 yBounds;
+uniform vec2 zBounds;
+uniform sampler3D volumeTexture;
+
+uniform int vctSteps;
+uniform float vctConeAngle;
+uniform float vctConeInitialHeight;
+uniform float vctLodOffset;
+uniform float vctDownScaling;
+
+vec4 loadBoard(uint i) {
+    if (halfInstances) {
+        uvec2 bits = halfBoards[i];
+        return vec4(unpackHalf2x16(bits.x), unpackHalf2x16(bits.y));
+    }
+    return boards[i];
+}
+
+#include "voxel_common.glsl"
+
+/* Same cone as conetrace_frag.glsl over the dense volume */
+float traceCone(vec3 position, vec3 direction, int steps, float coneAngle, float coneHeight) {
+    direction = normalize(direction);
+    direction /= voxelDim;
+    position /= voxelDim;
+
+    float color = 0.f;
+    for (int i = 1; i <= steps; i++) {
+        float coneRadius = coneHeight * tan(coneAngle / 2.f);
+        float lod = log2(max(1.f, 2.f * coneRadius));
+        float sampleColor = textureLod(volumeTexture, position + coneHeight * direction, lod + vctLodOffset).r;
+        color += sampleColor * float(i)/(steps*vctDownScaling);
+        coneHeight += coneRadius;
+    }
+
+    return color;
+}
+
+void main() {
+    vec4 board = loadBoard(gl_WorkGroupID.x);
+    vec3 center = volumePosition + board.xyz;
+    float radius = board.w * fluffiness;
+
+    /* Cell centres of the grid, rows from +y down */
+    float theta = (gl_LocalInvocationID.y + 0.5) / CACHE_ROWS * PI;
+    float phi = (gl_LocalInvocationID.x + 0.5) / CACHE_COLUMNS * 2 * PI;
+    vec3 dir = vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+    vec3 pos = center + dir * radius;
+
+    float light = traceCone(calculateVoxelLerp(pos), lightPos - pos, vctSteps, vctConeAngle, vctConeInitialHeight);
+    cache[boardIds[gl_WorkGroupID.x] * CACHE_ROWS * CACHE_COLUMNS + gl_LocalInvocationIndex] = light;
+}
\ No newline at end of file
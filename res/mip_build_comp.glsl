@@ -0,0 +1,39 @@
+#version 440 core
+
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+
+layout(binding=0, r8) uniform readonly image3D srcLevel;
+layout(binding=1, r8) uniform writeonly image3D dstLevel;
+
+/* Destination level region [regionMin, regionMax) */
+uniform ivec3 regionMin;
+uniform ivec3 regionMax;
+
+/* 0 - average, 1 - max, 2 - opacity corrected average */
+uniform int reduction;
+
+void main() {
+    ivec3 dst = regionMin + ivec3(gl_GlobalInvocationID);
+    if (any(greaterThanEqual(dst, regionMax))) {
+        return;
+    }
+
+    float sum = 0.f;
+    float maxAlpha = 0.f;
+    for (int i = 0; i < 8; i++) {
+        ivec3 offset = ivec3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+        float alpha = imageLoad(srcLevel, dst * 2 + offset).r;
+        sum += alpha;
+        maxAlpha = max(maxAlpha, alpha);
+    }
+
+    float alpha = sum / 8.f;
+    if (reduction == 1) {
+        alpha = maxAlpha;
+    }
+    else if (reduction == 2) {
+        /* A parent voxel is twice as deep as its children, 1-(1-a)^2 */
+        alpha = 1.f - (1.f - alpha) * (1.f - alpha);
+    }
+    imageStore(dstLevel, dst, vec4(alpha));
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#version 440 core
+
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+
+/* Octave sum normalized by its total amplitude */
+layout(binding=0, rgba8_snorm) uniform writeonly image3D bakedNoise;
+uniform int bakedSize;
+
+uniform sampler3D noiseMap;
+uniform int numOctaves;
+uniform float freqStep;
+uniform float persStep;
+uniform float amplitude;
+
+void main() {
+    ivec3 texel = ivec3(gl_GlobalInvocationID);
+    if (any(greaterThanEqual(texel, ivec3(bakedSize)))) {
+        return;
+    }
+
+    vec3 uv = (vec3(texel) + 0.5) / bakedSize;
+    vec4 noiseVal = vec4(0);
+    float freq = 1;
+    float pers = 1;
+    for (int i = 0; i < numOctaves; i++) {
+        /* Whole number frequencies keep the sum tileable over [0, 1) */
+        noiseVal += pers * texture(noiseMap, uv * max(1.f, round(freq)));
+        freq *= freqStep;
+        pers *= persStep;
+    }
+
+    imageStore(bakedNoise, texel, noiseVal / amplitude);
+}
\ No newline at end of file
@@ -0,0 +1,191 @@
+#version 440 core
+
+#define BRICK_SIZE 8
+#define MAX_LEVELS 10
+#define GROUP_SIZE 64
+#define MAX_GROUPS 65535u
+
+/* Build passes, see OctreeShader */
+#define PASS_FRAGMENTS  0
+#define PASS_RANGE      1
+#define PASS_FLAG       2
+#define PASS_ALLOC      3
+#define PASS_LEAF       4
+#define PASS_LEVEL_ARGS 5
+#define PASS_FILTER     6
+
+#define FLAGGED 0xFFFFFFFFu
+
+layout(local_size_x = GROUP_SIZE) in;
+
+layout(binding=0, r8) uniform readonly image3D volume;
+uniform int voxelDim;
+
+/* Sparse volumes read through the brick indirection from the atlas */
+layout(binding=2, r32ui) uniform readonly uimage3D brickIndirection;
+uniform bool brickMap;
+uniform int atlasBricks;
+
+/* Node - x first of 8 children (0 none), y filtered density bits */
+layout(std430, binding = 3) buffer Nodes {
+    uvec2 nodes[];
+};
+
+/* Fragment - x packed 10 bit voxel coordinates, y density bits */
+layout(std430, binding = 4) buffer Fragments {
+    uvec2 fragments[];
+};
+
+layout(std430, binding = 5) buffer Header {
+    uint fragArgs[3];
+    uint nodeArgs[3];
+    uint fragCount;
+    uint nodeCount;
+    uint levelStart[MAX_LEVELS + 2];
+};
+
+uniform int pass;
+uniform int level;
+uniform int depth;
+uniform uint fragCapacity;
+uniform uint nodeCapacity;
+
+/* 0 - average, 1 - max, 2 - opacity corrected average */
+uniform int reduction;
+
+float loadVoxel(ivec3 voxelIndex) {
+    if (!brickMap) {
+        return imageLoad(volume, voxelIndex).r;
+    }
+    uint slot = imageLoad(brickIndirection, voxelIndex / BRICK_SIZE).r;
+    if (slot == 0) {
+        return 0.f;
+    }
+    slot--;
+    ivec3 atlasBrick = ivec3(slot % atlasBricks, (slot / atlasBricks) % atlasBricks, slot / (atlasBricks * atlasBricks));
+    return imageLoad(volume, atlasBrick * BRICK_SIZE + voxelIndex % BRICK_SIZE).r;
+}
+
+uvec3 unpackCoords(uint packed) {
+    return uvec3(packed & 0x3FFu, (packed >> 10) & 0x3FFu, (packed >> 20) & 0x3FFu);
+}
+
+/* Walk from the root toward a voxel, stopping after a number of levels or at a missing child */
+uint traverse(uvec3 voxel, int levels) {
+    uint node = 0;
+    for (int i = 0; i < levels; i++) {
+        uint child = nodes[node].x;
+        if (child == 0 || child == FLAGGED) {
+            return FLAGGED;
+        }
+        uvec3 octant = (voxel >> uint(depth - 1 - i)) & 1u;
+        node = child + octant.x + octant.y * 2 + octant.z * 4;
+    }
+    return node;
+}
+
+uint groupsFor(uint count) {
+    return clamp((count + GROUP_SIZE - 1) / GROUP_SIZE, 1u, MAX_GROUPS);
+}
+
+void main() {
+    uint id = gl_GlobalInvocationID.x;
+    uint stride = gl_NumWorkGroups.x * GROUP_SIZE;
+    uint fragTotal = min(fragCount, fragCapacity);
+
+    /* Append every non-empty voxel - dispatched as (dim^2, dim) */
+    if (pass == PASS_FRAGMENTS) {
+        uint dim = uint(voxelDim);
+        if (id >= dim * dim) {
+            return;
+        }
+        ivec3 voxel = ivec3(id % dim, id / dim, gl_WorkGroupID.y);
+        float density = loadVoxel(voxel);
+        if (density > 0) {
+            uint slot = atomicAdd(fragCount, 1);
+            if (slot < fragCapacity) {
+                fragments[slot] = uvec2(voxel.x | (voxel.y << 10) | (voxel.z << 20), floatBitsToUint(density));
+            }
+        }
+    }
+    /* Close the previous level's allocations and size this level's dispatches */
+    else if (pass == PASS_RANGE) {
+        if (id > 0) {
+            return;
+        }
+        levelStart[level + 1] = min(nodeCount, nodeCapacity);
+        nodeArgs[0] = groupsFor(levelStart[level + 1] - levelStart[level]);
+        nodeArgs[1] = nodeArgs[2] = 1;
+        fragArgs[0] = groupsFor(fragTotal);
+        fragArgs[1] = fragArgs[2] = 1;
+    }
+    /* Mark the nodes at this level that contain a fragment */
+    else if (pass == PASS_FLAG) {
+        for (uint i = id; i < fragTotal; i += stride) {
+            uint node = traverse(unpackCoords(fragments[i].x), level);
+            if (node != FLAGGED) {
+                nodes[node].x = FLAGGED;
+            }
+        }
+    }
+    /* Give every marked node 8 empty children
+     * A block that overflows the pool is still zeroed up to the capacity,
+     * since the next level's range covers it and would otherwise read stale nodes */
+    else if (pass == PASS_ALLOC) {
+        uint count = levelStart[level + 1] - levelStart[level];
+        for (uint i = id; i < count; i += stride) {
+            uint node = levelStart[level] + i;
+            if (nodes[node].x != FLAGGED) {
+                continue;
+            }
+            uint child = atomicAdd(nodeCount, 8);
+            for (uint c = 0; c < 8 && child + c < nodeCapacity; c++) {
+                nodes[child + c] = uvec2(0);
+            }
+            nodes[node].x = child + 8 > nodeCapacity ? 0 : child;
+        }
+    }
+    /* Store fragment density in its leaf */
+    else if (pass == PASS_LEAF) {
+        for (uint i = id; i < fragTotal; i += stride) {
+            uint node = traverse(unpackCoords(fragments[i].x), depth);
+            if (node != FLAGGED) {
+                nodes[node].y = fragments[i].y;
+            }
+        }
+    }
+    /* Size a filter dispatch over an existing level */
+    else if (pass == PASS_LEVEL_ARGS) {
+        if (id > 0) {
+            return;
+        }
+        nodeArgs[0] = groupsFor(levelStart[level + 1] - levelStart[level]);
+        nodeArgs[1] = nodeArgs[2] = 1;
+    }
+    /* Interior density mirrors the volume mips */
+    else if (pass == PASS_FILTER) {
+        uint count = levelStart[level + 1] - levelStart[level];
+        for (uint i = id; i < count; i += stride) {
+            uint node = levelStart[level] + i;
+            uint child = nodes[node].x;
+            if (child == 0) {
+                continue;
+            }
+            float sum = 0.f;
+            float maxDensity = 0.f;
+            for (uint c = 0; c < 8; c++) {
+                float density = uintBitsToFloat(nodes[child + c].y);
+                sum += density;
+                maxDensity = max(maxDensity, density);
+            }
+            float density = sum / 8.f;
+            if (reduction == 1) {
+                density = maxDensity;
+            }
+            else if (reduction == 2) {
+                density = 1.f - (1.f - density) * (1.f - density);
+            }
+            nodes[node].y = floatBitsToUint(density);
+        }
+    }
+}
\ No newline at end of file
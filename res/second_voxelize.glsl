@@ -1,5 +1,7 @@
 #version 440 core
 
+#define BRICK_SIZE 8
+
 in vec3 fragPos;
 
 layout(binding=0, r8) uniform image3D volume;
@@ -9,43 +11,55 @@ uniform vec2 yBounds;
 uniform vec2 zBounds;
 uniform float stepSize;
 
-layout(binding=1, rgba32f) uniform image2D positionMap;
+uniform sampler2D lightDepthMap;
+uniform mat4 lightPi;
+uniform mat4 lightVi;
 
 out vec4 color;
 
-/* Linear map from aribtray box(?) in world space to 3D volume 
- * Voxel indices: [0, dimension - 1] */
-vec3 calculateVoxelLerp(vec3 pos) {
-    float rangeX = xBounds.y - xBounds.x;
-    float rangeY = yBounds.y - yBounds.x;
-    float rangeZ = zBounds.y - zBounds.x;
-
-    float x = voxelDim * ((pos.x - xBounds.x) / rangeX);
-    float y = voxelDim * ((pos.y - yBounds.x) / rangeY);
-    float z = voxelDim * ((pos.z - zBounds.x) / rangeZ);
+#include "voxel_common.glsl"
 
-	return vec3(x, y, z);
-}
+/* Sparse volumes write through the brick indirection into the atlas */
+layout(binding=2, r32ui) uniform readonly uimage3D brickIndirection;
+uniform bool brickMap;
+uniform int atlasBricks;
 
-ivec3 calculateVoxelIndex(vec3 pos) {
-	return ivec3(calculateVoxelLerp(pos));
+void storeVoxel(ivec3 voxelIndex, vec4 value) {
+    if (!brickMap) {
+        imageStore(volume, voxelIndex, value);
+        return;
+    }
+    if (any(lessThan(voxelIndex, ivec3(0))) || any(greaterThanEqual(voxelIndex, ivec3(voxelDim)))) {
+        return;
+    }
+    uint slot = imageLoad(brickIndirection, voxelIndex / BRICK_SIZE).r;
+    if (slot == 0) {
+        return;
+    }
+    slot--;
+    ivec3 atlasBrick = ivec3(slot % atlasBricks, (slot / atlasBricks) % atlasBricks, slot / (atlasBricks * atlasBricks));
+    imageStore(volume, atlasBrick * BRICK_SIZE + voxelIndex % BRICK_SIZE, value);
 }
 
 void main() {
-    /* Read from position map */
-    vec4 worldPos = imageLoad(positionMap, ivec2(gl_FragCoord.xy));
+    /* Read from light depth map and rebuild world position
+     * Light projection is orthographic so depth doesn't affect xy */
+    float depth = texelFetch(lightDepthMap, ivec2(gl_FragCoord.xy), 0).r;
+    vec2 ndc = gl_FragCoord.xy / vec2(textureSize(lightDepthMap, 0)) * 2 - 1;
+    vec2 lightPos = (lightPi * vec4(ndc, 0, 1)).xy;
+    vec4 worldPos = vec4((lightVi * vec4(lightPos, -depth, 1)).xyz, depth);
     /* If this voxel is active (is already either black or white)
      * Set it to white */
     if (worldPos.a > 0) {
         vec4 col = vec4(1);
-        imageStore(volume, calculateVoxelIndex(worldPos.xyz), col);
-        imageStore(volume, calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3( 1,  1,  1))), col);
-        imageStore(volume, calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3( 1,  1, -1))), col);
-        imageStore(volume, calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3( 1, -1,  1))), col);
-        imageStore(volume, calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3( 1, -1, -1))), col);
-        imageStore(volume, calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3(-1,  1,  1))), col);
-        imageStore(volume, calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3(-1,  1, -1))), col);
-        imageStore(volume, calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3(-1, -1,  1))), col);
-        imageStore(volume, calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3(-1, -1, -1))), col);
+        storeVoxel(calculateVoxelIndex(worldPos.xyz), col);
+        storeVoxel(calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3( 1,  1,  1))), col);
+        storeVoxel(calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3( 1,  1, -1))), col);
+        storeVoxel(calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3( 1, -1,  1))), col);
+        storeVoxel(calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3( 1, -1, -1))), col);
+        storeVoxel(calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3(-1,  1,  1))), col);
+        storeVoxel(calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3(-1,  1, -1))), col);
+        storeVoxel(calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3(-1, -1,  1))), col);
+        storeVoxel(calculateVoxelIndex(worldPos.xyz + stepSize * normalize(vec3(-1, -1, -1))), col);
     }
 }
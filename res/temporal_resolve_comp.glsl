@@ -0,0 +1,80 @@
+#version 440 core
+
+#define FAR_DEPTH 1e30
+
+/* One thread per history pixel */
+layout(local_size_x = 8, local_size_y = 8) in;
+
+/* This frame's clouds at half the history resolution per axis,
+ * drawn with the projection shifted by a sub-pixel jitter */
+uniform sampler2D currentColor;
+uniform sampler2D currentDepth;
+uniform ivec2 currentSize;
+uniform vec2 jitter;            // Projection shift this frame in current pixels
+
+/* Accumulated result, read back next frame as history */
+layout(binding=0, rgba16f) uniform writeonly image2D resolvedColor;
+layout(binding=1, r32f) uniform writeonly image2D resolvedDepth;
+
+uniform sampler2D historyColor;
+uniform sampler2D historyDepth;
+uniform bool historyValid;
+uniform ivec2 targetSize;
+
+/* Rebuild world positions from view depth and reproject into last frame */
+uniform mat4 Vi;
+uniform vec2 projScale;         // P[0][0], P[1][1]
+uniform mat4 prevPV;
+
+uniform float historyWeight;    // Share of the result kept from clamped history
+uniform float depthTolerance;   // Relative view depth change accepted from history
+
+void main() {
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, targetSize))) {
+        return;
+    }
+
+    /* This pixel lands shifted by the jitter in the current image */
+    vec2 uv = (vec2(pixel) + 0.5) / vec2(targetSize);
+    vec2 currentUV = uv + jitter / vec2(currentSize);
+    ivec2 texel = clamp(ivec2(currentUV * vec2(currentSize)), ivec2(0), currentSize - 1);
+    vec4 color = textureLod(currentColor, currentUV, 0);
+    float depth = texelFetch(currentDepth, texel, 0).r;
+
+    /* Bounds of what this frame produced nearby, and the nearest cloud to reproject */
+    vec4 neighborMin = color;
+    vec4 neighborMax = color;
+    float nearestDepth = depth;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            ivec2 neighbor = clamp(texel + ivec2(x, y), ivec2(0), currentSize - 1);
+            vec4 neighborColor = texelFetch(currentColor, neighbor, 0);
+            neighborMin = min(neighborMin, neighborColor);
+            neighborMax = max(neighborMax, neighborColor);
+            nearestDepth = min(nearestDepth, texelFetch(currentDepth, neighbor, 0).r);
+        }
+    }
+
+    /* Exponential moving average over history clamped into the neighborhood
+     * Disocclusions and pixels without cloud start over from this frame */
+    vec4 result = color;
+    if (historyValid && nearestDepth < FAR_DEPTH) {
+        vec2 ndc = uv * 2 - 1;
+        vec4 viewPos = vec4(ndc * nearestDepth / projScale, -nearestDepth, 1);
+        vec4 prevClip = prevPV * (Vi * viewPos);
+        vec2 prevUV = prevClip.xy / prevClip.w * 0.5 + 0.5;
+
+        if (prevClip.w > 0 && all(greaterThanEqual(prevUV, vec2(0))) && all(lessThanEqual(prevUV, vec2(1)))) {
+            ivec2 prevPixel = min(ivec2(prevUV * vec2(targetSize)), targetSize - 1);
+            float prevDepth = texelFetch(historyDepth, prevPixel, 0).r;
+            if (prevDepth < FAR_DEPTH && abs(prevDepth - nearestDepth) < depthTolerance * nearestDepth) {
+                vec4 history = clamp(textureLod(historyColor, prevUV, 0), neighborMin, neighborMax);
+                result = mix(color, history, historyWeight);
+            }
+        }
+    }
+
+    imageStore(resolvedColor, pixel, result);
+    imageStore(resolvedDepth, pixel, vec4(depth));
+}
\ No newline at end of file
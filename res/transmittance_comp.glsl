@@ -0,0 +1,44 @@
+#version 440 core
+
+/* One thread per light-space column, swept plane by plane away from the light */
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding=1, r16f) uniform writeonly image3D transmittance;
+uniform int transmittanceSize;
+
+uniform sampler3D volumeTexture;
+uniform int voxelDim;
+uniform vec2 xBounds;
+uniform vec2 yBounds;
+uniform vec2 zBounds;
+
+/* Light's inverse view projection, ndc z -1 is nearest the light */
+uniform mat4 lightPVi;
+uniform float sliceLength;   // World distance between planes in voxels
+uniform float extinction;    // Optical depth per voxel of full density
+
+#include "voxel_common.glsl"
+
+void main() {
+    ivec2 column = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(column, ivec2(transmittanceSize)))) {
+        return;
+    }
+
+    vec2 ndc = (vec2(column) + 0.5) / transmittanceSize * 2 - 1;
+    float opticalDepth = 0.f;
+    for (int slice = 0; slice < transmittanceSize; slice++) {
+        float ndcZ = (slice + 0.5) / transmittanceSize * 2 - 1;
+        vec4 worldPos = lightPVi * vec4(ndc, ndcZ, 1);
+        vec3 uvw = calculateVoxelLerp(worldPos.xyz / worldPos.w) / voxelDim;
+
+        /* Transmittance reaching the middle of this plane */
+        float density = 0.f;
+        if (all(greaterThanEqual(uvw, vec3(0))) && all(lessThanEqual(uvw, vec3(1)))) {
+            density = textureLod(volumeTexture, uvw, 0).r;
+        }
+        float sliceDepth = density * extinction * sliceLength;
+        imageStore(transmittance, ivec3(column, slice), vec4(exp(-(opticalDepth + 0.5 * sliceDepth))));
+        opticalDepth += sliceDepth;
+    }
+}
\ No newline at end of file
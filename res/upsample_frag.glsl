@@ -0,0 +1,45 @@
+#version 440 core
+
+in vec2 fragTex;
+
+/* Reduced resolution clouds - premultiplied color and nearest view depth */
+uniform sampler2D cloudColor;
+uniform sampler2D cloudDepth;
+
+/* How quickly texels farther behind the nearest cloud lose weight */
+uniform float depthSharpness;
+
+out vec4 color;
+
+void main() {
+    vec2 size = vec2(textureSize(cloudColor, 0));
+    vec2 texel = fragTex * size - 0.5;
+    ivec2 base = ivec2(floor(texel));
+    vec2 f = texel - vec2(base);
+
+    /* 2x2 footprint with bilinear weights */
+    ivec2 offsets[4] = ivec2[](ivec2(0, 0), ivec2(1, 0), ivec2(0, 1), ivec2(1, 1));
+    float bilinear[4] = float[]((1 - f.x) * (1 - f.y), f.x * (1 - f.y), (1 - f.x) * f.y, f.x * f.y);
+    ivec2 maxTexel = ivec2(size) - 1;
+
+    /* Nearest cloud in the footprint is the edge we keep sharp */
+    float depths[4];
+    float nearest = 1e30;
+    for (int i = 0; i < 4; i++) {
+        depths[i] = texelFetch(cloudDepth, clamp(base + offsets[i], ivec2(0), maxTexel), 0).r;
+        nearest = min(nearest, depths[i]);
+    }
+
+    vec4 sum = vec4(0);
+    float weightSum = 0.f;
+    for (int i = 0; i < 4; i++) {
+        vec4 sampleColor = texelFetch(cloudColor, clamp(base + offsets[i], ivec2(0), maxTexel), 0);
+        /* Empty texels only count toward coverage, not color */
+        float depthWeight = depths[i] >= 1e29 ? 1.f : 1.f / (1.f + depthSharpness * abs(depths[i] - nearest));
+        float weight = bilinear[i] * depthWeight + 1e-4;
+        sum += sampleColor * weight;
+        weightSum += weight;
+    }
+
+    color = sum / weightSum;
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+/* Shared voxel addressing, included after voxelDim and the bounds uniforms */
+
+/* Linear map from an arbitrary box in world space to 3D volume
+ * Voxel indices: [0, dimension - 1] */
+vec3 calculateVoxelLerp(vec3 pos) {
+    float rangeX = xBounds.y - xBounds.x;
+    float rangeY = yBounds.y - yBounds.x;
+    float rangeZ = zBounds.y - zBounds.x;
+
+    float x = voxelDim * ((pos.x - xBounds.x) / rangeX);
+    float y = voxelDim * ((pos.y - yBounds.x) / rangeY);
+    float z = voxelDim * ((pos.z - zBounds.x) / rangeZ);
+
+    return vec3(x, y, z);
+}
+
+ivec3 calculateVoxelIndex(vec3 pos) {
+    return ivec3(calculateVoxelLerp(pos));
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#version 440 core
+
+#define BRICK_SIZE 8
+
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+
+layout(binding=0, r8) uniform readonly image3D volume;
+uniform int voxelDim;
+uniform vec3 volumeMin;
+uniform vec3 voxelSize;
+
+/* Sparse volumes read through the brick indirection from the atlas */
+layout(binding=2, r32ui) uniform readonly uimage3D brickIndirection;
+uniform bool brickMap;
+uniform int atlasBricks;
+
+/* Active voxels - xyz world position, w voxel data */
+layout(std430, binding = 0) writeonly buffer Voxels {
+    vec4 voxels[];
+};
+
+/* DrawElementsIndirectCommand, instance count doubles as the append counter */
+layout(std430, binding = 1) buffer DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    uint baseVertex;
+    uint baseInstance;
+};
+
+float loadVoxel(ivec3 voxelIndex) {
+    if (!brickMap) {
+        return imageLoad(volume, voxelIndex).r;
+    }
+    uint slot = imageLoad(brickIndirection, voxelIndex / BRICK_SIZE).r;
+    if (slot == 0) {
+        return 0.f;
+    }
+    slot--;
+    ivec3 atlasBrick = ivec3(slot % atlasBricks, (slot / atlasBricks) % atlasBricks, slot / (atlasBricks * atlasBricks));
+    return imageLoad(volume, atlasBrick * BRICK_SIZE + voxelIndex % BRICK_SIZE).r;
+}
+
+void main() {
+    ivec3 voxelIndex = ivec3(gl_GlobalInvocationID);
+    if (any(greaterThanEqual(voxelIndex, ivec3(voxelDim)))) {
+        return;
+    }
+
+    float data = loadVoxel(voxelIndex);
+    if (data == 0) {
+        return;
+    }
+
+    uint slot = atomicAdd(instanceCount, 1);
+    voxels[slot] = vec4(volumeMin + vec3(voxelIndex) * voxelSize, data);
+}
\ No newline at end of file
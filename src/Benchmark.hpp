@@ -0,0 +1,123 @@
+/* Benchmark class
+ * Offline timing runs, results print to stdout */
+#pragma once
+#ifndef _BENCHMARK_HPP_
+#define _BENCHMARK_HPP_
+
+#include "BillboardSorter.hpp"
+#include "CloudVolume.hpp"
+#include "NoiseGenerator.hpp"
+#include "Sun.hpp"
+#include "Util.hpp"
+#include "Shaders/VoxelizeShader.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+class Benchmark {
+    public:
+        /* Time a function over a number of runs, returns average milliseconds */
+        template <typename F>
+        static double time(const int runs, F func) {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < runs; i++) {
+                func();
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            return std::chrono::duration<double, std::milli>(end - start).count() / runs;
+        }
+
+        /* Sort randomly placed billboards from a randomly moving point */
+        static void sortBoards() {
+            const int counts[] = { 1000, 10000, 100000, 1000000 };
+            const int runs = 10;
+            BillboardSorter sorter;
+
+            std::cout << "Billboard sort benchmark (" << runs << " runs each)" << std::endl;
+            for (int count : counts) {
+                std::vector<glm::vec4> boards(count);
+                std::vector<uint32_t> ids(count);
+                for (int i = 0; i < count; i++) {
+                    boards[i] = glm::vec4(Util::genRandomVec3(-5.f, 5.f), Util::genRandom(1.f, 2.5f));
+                    ids[i] = i;
+                }
+                double ms = time(runs, [&]() {
+                    sorter.sort(boards, ids, Util::genRandomVec3(-50.f, 50.f));
+                });
+                std::cout << "  " << count << " billboards: " << ms << " ms" << std::endl;
+            }
+        }
+
+        /* Voxelize a copy of a volume's billboards at increasing dimensions
+         * through the raster, compute, and density accumulation paths
+         * GPU work is finished before the clock stops */
+        static void voxelize(VoxelizeShader *voxelizer, CloudVolume *source) {
+            const int dimensions[] = { 32, 64, 128, 256 };
+            const int runs = 10;
+            const bool skipUnchanged = voxelizer->skipUnchanged;
+            const bool useCompute = voxelizer->useCompute;
+            const bool accumulateDensity = voxelizer->accumulateDensity;
+            voxelizer->skipUnchanged = false;
+
+            std::cout << "Voxelize benchmark (" << source->billboards.count << " billboards, " << runs << " runs each)" << std::endl;
+            for (int dim : dimensions) {
+                CloudVolume volume(dim, source->xBounds, source->position, source->levels);
+                volume.yBounds = source->yBounds;
+                volume.zBounds = source->zBounds;
+                volume.billboards = source->billboards;
+                volume.fluffiness = source->fluffiness;
+                volume.halfFloatInstances = source->halfFloatInstances;
+                volume.update();
+                Sun::update(&volume);
+
+                double ms[3];
+                for (int mode = 0; mode < 3; mode++) {
+                    voxelizer->useCompute = mode == 1;
+                    voxelizer->accumulateDensity = mode == 2;
+                    voxelizer->voxelize(&volume);
+                    glFinish();
+                    ms[mode] = time(runs, [&]() {
+                        voxelizer->voxelize(&volume);
+                        glFinish();
+                    });
+                }
+                std::cout << "  " << dim << "^3: raster " << ms[0] << " ms, compute " << ms[1] << " ms, density " << ms[2] << " ms" << std::endl;
+            }
+
+            voxelizer->skipUnchanged = skipUnchanged;
+            voxelizer->useCompute = useCompute;
+            voxelizer->accumulateDensity = accumulateDensity;
+            Sun::update(source);
+        }
+
+        /* Generate noise volumes at increasing dimensions with the original
+         * generator and with every basis of the threaded one */
+        static void noise() {
+            const int dimensions[] = { 32, 64, 128, 256 };
+            const char *names[] = { "white", "value", "perlin", "worley", "curl" };
+            const int runs = 5;
+            std::vector<NoiseGenerator::Texel> texels;
+
+            std::cout << "Noise benchmark (" << runs << " runs each)" << std::endl;
+            for (int dim : dimensions) {
+                double ms = time(runs, [&]() {
+                    NoiseGenerator::generateReference(dim, texels);
+                });
+                std::cout << "  " << dim << "^3: reference " << ms << " ms";
+
+                NoiseGenerator::Params params;
+                params.dimension = dim;
+                for (int basis = NoiseGenerator::WHITE; basis <= NoiseGenerator::CURL; basis++) {
+                    params.basis = (NoiseGenerator::Basis) basis;
+                    ms = time(runs, [&]() {
+                        NoiseGenerator::generate(params, texels);
+                    });
+                    std::cout << ", " << names[basis] << " " << ms << " ms";
+                }
+                std::cout << std::endl;
+            }
+        }
+};
+
+#endif
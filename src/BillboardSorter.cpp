@@ -0,0 +1,150 @@
+#include "BillboardSorter.hpp"
+
+#include "Util.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+void BillboardSorter::sort(std::vector<glm::vec4> &boards, std::vector<uint32_t> &ids, const glm::vec3 &point) {
+    if (boards.size() < 2) {
+        return;
+    }
+
+    computeKeys(boards, point);
+    radixSort();
+    gather(boards, ids);
+}
+
+bool BillboardSorter::repair(std::vector<glm::vec4> &boards, std::vector<uint32_t> &ids, const glm::vec3 &point) {
+    if (boards.size() < 2) {
+        return true;
+    }
+
+    computeKeys(boards, point);
+
+    /* Move keys and billboards together so no gather is needed */
+    unsigned int budget = REPAIR_MOVE_BUDGET * (unsigned int)boards.size();
+    for (unsigned int i = 1; i < keys.size(); i++) {
+        uint32_t key = keys[i];
+        if (keys[i - 1] <= key) {
+            continue;
+        }
+        glm::vec4 board = boards[i];
+        uint32_t id = ids[i];
+        unsigned int j = i;
+        while (j > 0 && keys[j - 1] > key) {
+            keys[j] = keys[j - 1];
+            boards[j] = boards[j - 1];
+            ids[j] = ids[j - 1];
+            j--;
+        }
+        keys[j] = key;
+        boards[j] = board;
+        ids[j] = id;
+
+        /* Arrays are still a valid permutation if we bail out here */
+        if ((i - j) > budget) {
+            return false;
+        }
+        budget -= i - j;
+    }
+
+    return true;
+}
+
+/* Squared distance is non-negative so its IEEE bit pattern already orders
+ * like an unsigned int - invert it so the farthest billboard sorts first */
+void BillboardSorter::computeKeys(const std::vector<glm::vec4> &boards, const glm::vec3 &point) {
+    keys.resize(boards.size());
+    order.resize(boards.size());
+    for (unsigned int i = 0; i < boards.size(); i++) {
+        glm::vec3 delta = glm::vec3(boards[i]) - point;
+        float dist = glm::dot(delta, delta);
+        uint32_t bits;
+        std::memcpy(&bits, &dist, sizeof(bits));
+        keys[i] = ~bits;
+        order[i] = i;
+    }
+}
+
+void BillboardSorter::radixSort() {
+    unsigned int workers = 1;
+    if (keys.size() >= PARALLEL_THRESHOLD) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    tmpKeys.resize(keys.size());
+    tmpOrder.resize(order.size());
+    histograms.resize(workers * RADIX_BUCKETS);
+
+    for (int pass = 0; pass < RADIX_PASSES; pass++) {
+        radixPass(pass * RADIX_BITS, workers);
+    }
+}
+
+/* One stable counting pass over a single digit
+ * Each worker histograms and scatters its own contiguous slice */
+void BillboardSorter::radixPass(int shift, unsigned int workers) {
+    const unsigned int count = (unsigned int)keys.size();
+    const unsigned int slice = (count + workers - 1) / workers;
+
+    /* Per-worker digit histograms */
+    std::fill(histograms.begin(), histograms.end(), 0);
+    Util::parallelFor(workers, [&](unsigned int t) {
+        unsigned int *hist = &histograms[t * RADIX_BUCKETS];
+        unsigned int end = std::min(count, (t + 1) * slice);
+        for (unsigned int i = t * slice; i < end; i++) {
+            hist[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        }
+    });
+
+    /* Skip the pass if every key shares this digit */
+    for (int d = 0; d < RADIX_BUCKETS; d++) {
+        unsigned int total = 0;
+        for (unsigned int t = 0; t < workers; t++) {
+            total += histograms[t * RADIX_BUCKETS + d];
+        }
+        if (total == count) {
+            return;
+        }
+        if (total) {
+            break;
+        }
+    }
+
+    /* Exclusive prefix sum in digit-major, worker-minor order keeps the pass stable */
+    unsigned int offset = 0;
+    for (int d = 0; d < RADIX_BUCKETS; d++) {
+        for (unsigned int t = 0; t < workers; t++) {
+            unsigned int bucket = histograms[t * RADIX_BUCKETS + d];
+            histograms[t * RADIX_BUCKETS + d] = offset;
+            offset += bucket;
+        }
+    }
+
+    /* Scatter */
+    Util::parallelFor(workers, [&](unsigned int t) {
+        unsigned int *offsets = &histograms[t * RADIX_BUCKETS];
+        unsigned int end = std::min(count, (t + 1) * slice);
+        for (unsigned int i = t * slice; i < end; i++) {
+            unsigned int dst = offsets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+            tmpKeys[dst] = keys[i];
+            tmpOrder[dst] = order[i];
+        }
+    });
+
+    keys.swap(tmpKeys);
+    order.swap(tmpOrder);
+}
+
+/* Apply the sorted permutation to the billboards and their ids in one pass */
+void BillboardSorter::gather(std::vector<glm::vec4> &boards, std::vector<uint32_t> &ids) {
+    tmpBoards.resize(boards.size());
+    tmpIds.resize(ids.size());
+    for (unsigned int i = 0; i < order.size(); i++) {
+        tmpBoards[i] = boards[order[i]];
+        tmpIds[i] = ids[order[i]];
+    }
+    boards.swap(tmpBoards);
+    ids.swap(tmpIds);
+}
@@ -0,0 +1,50 @@
+/* Billboard sorter
+ * Orders billboards back to front using an LSD radix sort over
+ * quantized 32-bit depth keys */
+#pragma once
+#ifndef _BILLBOARD_SORTER_HPP_
+#define _BILLBOARD_SORTER_HPP_
+
+#include "glm/glm.hpp"
+
+#include <vector>
+#include <cstdint>
+
+class BillboardSorter {
+    public:
+        /* Sort packed (position, scale) billboards back to front relative to a point
+         * Their ids are moved along with them */
+        void sort(std::vector<glm::vec4> &, std::vector<uint32_t> &, const glm::vec3 &);
+
+        /* Insertion sort already nearly-sorted billboards and their ids in place
+         * Returns false if the order was too far off to finish cheaply */
+        bool repair(std::vector<glm::vec4> &, std::vector<uint32_t> &, const glm::vec3 &);
+
+        /* Element counts at or above this are split across worker threads */
+        static const unsigned int PARALLEL_THRESHOLD = 1 << 16;
+
+        /* Element moves per billboard a repair may spend before giving up */
+        static const unsigned int REPAIR_MOVE_BUDGET = 4;
+
+    private:
+        /* Radix sort parameters - 4 passes of 8 bits */
+        static const int RADIX_BITS = 8;
+        static const int RADIX_BUCKETS = 1 << RADIX_BITS;
+        static const int RADIX_PASSES = 32 / RADIX_BITS;
+
+        void computeKeys(const std::vector<glm::vec4> &, const glm::vec3 &);
+        void radixSort();
+        void radixPass(int, unsigned int);
+        void gather(std::vector<glm::vec4> &, std::vector<uint32_t> &);
+
+        /* Persistent scratch so sorting doesn't allocate every frame */
+        std::vector<uint32_t> keys;
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> tmpKeys;
+        std::vector<uint32_t> tmpOrder;
+        std::vector<glm::vec4> tmpBoards;
+        std::vector<uint32_t> tmpIds;
+        std::vector<unsigned int> histograms;
+};
+
+#endif
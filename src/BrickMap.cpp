@@ -0,0 +1,244 @@
+#include "BrickMap.hpp"
+
+#include "CloudVolume.hpp"
+#include "Shaders/GLSL.hpp"
+
+#include <algorithm>
+
+/* Bytes for a cube of voxels and its mips */
+static size_t mipChainBytes(int size, int levels) {
+    size_t bytes = 0;
+    for (int i = 0; i < levels && size; i++, size >>= 1) {
+        bytes += (size_t)size * size * size;
+    }
+    return bytes;
+}
+
+BrickMap::~BrickMap() {
+    if (indirectionId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &indirectionId));
+    }
+    if (atlasId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &atlasId));
+    }
+}
+
+void BrickMap::allocate(const CloudVolume *volume) {
+    const int brickSize = CloudVolume::BRICK_SIZE;
+    int size = (volume->dimension + brickSize - 1) / brickSize;
+    if (size != gridSize) {
+        resizeIndirection(size);
+    }
+    repacked = false;
+    allocatedBricks = 0;
+    freedBricks = 0;
+
+    /* Mark bricks covered by each sphere's bounds, padded a voxel for neighbor writes */
+    std::fill(covered.begin(), covered.end(), 0);
+    glm::vec3 boundsMin(volume->xBounds.x, volume->yBounds.x, volume->zBounds.x);
+    for (int i = 0; i < volume->billboards.count; i++) {
+        const glm::vec4 &board = volume->billboards.instances[i];
+        float radius = board.w * volume->fluffiness;
+        glm::ivec3 voxelMin = glm::ivec3(glm::floor((glm::vec3(board) - radius - boundsMin) / volume->voxelSize)) - 1;
+        glm::ivec3 voxelMax = glm::ivec3(glm::floor((glm::vec3(board) + radius - boundsMin) / volume->voxelSize)) + 1;
+        glm::ivec3 brickMin = glm::max(voxelMin, 0) / brickSize;
+        glm::ivec3 brickMax = glm::min(voxelMax / brickSize, gridSize - 1);
+        for (int z = brickMin.z; z <= brickMax.z; z++) {
+            for (int y = brickMin.y; y <= brickMax.y; y++) {
+                for (int x = brickMin.x; x <= brickMax.x; x++) {
+                    covered[x + y * gridSize + z * gridSize * gridSize] = 1;
+                }
+            }
+        }
+    }
+
+    /* Free bricks nothing touches anymore */
+    int needed = 0;
+    for (size_t i = 0; i < indirection.size(); i++) {
+        if (indirection[i] && !covered[i]) {
+            freeSlots.push_back(indirection[i] - 1);
+            indirection[i] = 0;
+            freedBricks++;
+        }
+        needed += covered[i];
+    }
+    residentBricks -= freedBricks;
+
+    /* Recreate the atlas at the smallest size that fits when it overflows,
+     * or once it's less than half of the next size down */
+    int levelCap = 1;
+    while ((brickSize >> levelCap) > 0) {
+        levelCap++;
+    }
+    int atlasLevels = std::min(volume->levels, levelCap);
+    int capacity = atlasBricks * atlasBricks * atlasBricks;
+    if (needed > capacity || needed * 16 <= capacity || atlasLevels != levels) {
+        int side = 1;
+        while (side * side * side < needed) {
+            side *= 2;
+        }
+        if (side != atlasBricks || atlasLevels != levels) {
+            resizeAtlas(side, atlasLevels);
+            repacked = true;
+        }
+    }
+
+    /* Repacking hands out slots from scratch, otherwise only new bricks get a slot */
+    if (repacked) {
+        freeSlots.clear();
+        slotCount = 0;
+        allocatedBricks = needed;
+        for (size_t i = 0; i < indirection.size(); i++) {
+            indirection[i] = covered[i] ? ++slotCount : 0;
+        }
+    }
+    else {
+        for (size_t i = 0; i < indirection.size(); i++) {
+            if (covered[i] && !indirection[i]) {
+                GLuint slot = slotCount;
+                if (freeSlots.size()) {
+                    slot = freeSlots.back();
+                    freeSlots.pop_back();
+                }
+                else {
+                    slotCount++;
+                }
+                indirection[i] = slot + 1;
+                allocatedBricks++;
+            }
+        }
+    }
+    residentBricks = needed;
+
+    if (repacked || allocatedBricks || freedBricks) {
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, indirectionId));
+        CHECK_GL_CALL(glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, gridSize, gridSize, gridSize, GL_RED_INTEGER, GL_UNSIGNED_INT, indirection.data()));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    }
+}
+
+/* Only level 0 is cleared, mips are rebuilt from it over the updated region
+ * Reused slots hold stale voxels, but new bricks are always inside the region being rewritten */
+void BrickMap::clearGPU(const glm::ivec3 &min, const glm::ivec3 &max) {
+    const int brickSize = CloudVolume::BRICK_SIZE;
+    if (repacked) {
+        updatedMin = glm::ivec3(0);
+        updatedMax = glm::ivec3(atlasBricks * brickSize);
+        return;
+    }
+
+    glm::ivec3 brickMin = glm::max(min, 0) / brickSize;
+    glm::ivec3 brickMax = glm::min((max + brickSize - 1) / brickSize, gridSize);
+    std::vector<glm::ivec3> bricks;
+    for (int z = brickMin.z; z < brickMax.z; z++) {
+        for (int y = brickMin.y; y < brickMax.y; y++) {
+            for (int x = brickMin.x; x < brickMax.x; x++) {
+                GLuint slot = indirection[x + y * gridSize + z * gridSize * gridSize];
+                if (slot--) {
+                    bricks.push_back(glm::ivec3(slot % atlasBricks, (slot / atlasBricks) % atlasBricks, slot / (atlasBricks * atlasBricks)));
+                }
+            }
+        }
+    }
+
+    updatedMin = glm::ivec3(atlasBricks * brickSize);
+    updatedMax = glm::ivec3(0);
+    if (bricks.empty()) {
+        updatedMin = updatedMax;
+        return;
+    }
+
+    /* One clear beats thousands of small ones when every resident brick is dirty */
+    bool clearAll = bricks.size() == (size_t) residentBricks;
+    if (clearAll) {
+        CHECK_GL_CALL(glClearTexImage(atlasId, 0, GL_RED, GL_FLOAT, nullptr));
+    }
+    for (const glm::ivec3 &brick : bricks) {
+        glm::ivec3 offset = brick * brickSize;
+        if (!clearAll) {
+            CHECK_GL_CALL(glClearTexSubImage(atlasId, 0, offset.x, offset.y, offset.z, brickSize, brickSize, brickSize, GL_RED, GL_FLOAT, nullptr));
+        }
+        updatedMin = glm::min(updatedMin, offset);
+        updatedMax = glm::max(updatedMax, offset + brickSize);
+    }
+}
+
+void BrickMap::clearGPU() {
+    for (int i = 0; i < levels; i++) {
+        CHECK_GL_CALL(glClearTexImage(atlasId, i, GL_RED, GL_FLOAT, nullptr));
+    }
+}
+
+/* Drop all storage, the next allocate starts from an empty atlas */
+void BrickMap::release() {
+    if (indirectionId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &indirectionId));
+    }
+    if (atlasId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &atlasId));
+    }
+    indirectionId = atlasId = 0;
+    gridSize = atlasBricks = levels = residentBricks = 0;
+    allocatedBricks = freedBricks = slotCount = 0;
+    indirection.clear();
+    covered.clear();
+    freeSlots.clear();
+}
+
+size_t BrickMap::residentBytes() const {
+    int brickSize = CloudVolume::BRICK_SIZE;
+    return residentBricks * mipChainBytes(brickSize, levels) + indirection.size() * sizeof(GLuint);
+}
+
+size_t BrickMap::atlasBytes() const {
+    return mipChainBytes(atlasBricks * CloudVolume::BRICK_SIZE, levels) + indirection.size() * sizeof(GLuint);
+}
+
+size_t BrickMap::denseBytes(const CloudVolume *volume) {
+    return mipChainBytes(volume->dimension, volume->levels);
+}
+
+void BrickMap::resizeIndirection(int size) {
+    /* Old slots don't map onto the new grid, so every brick starts over */
+    gridSize = size;
+    indirection.assign(size * size * size, 0);
+    covered.assign(size * size * size, 0);
+    freeSlots.clear();
+    slotCount = 0;
+    residentBricks = 0;
+    if (atlasId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &atlasId));
+    }
+    atlasId = 0;
+    atlasBricks = 0;
+    if (indirectionId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &indirectionId));
+    }
+    CHECK_GL_CALL(glGenTextures(1, &indirectionId));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, indirectionId));
+    CHECK_GL_CALL(glTexStorage3D(GL_TEXTURE_3D, 1, GL_R32UI, size, size, size));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+}
+
+/* Bricks are BRICK_SIZE aligned so each atlas mip stays inside its brick */
+void BrickMap::resizeAtlas(int side, int mips) {
+    atlasBricks = side;
+    levels = mips;
+    int size = side * CloudVolume::BRICK_SIZE;
+    if (atlasId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &atlasId));
+    }
+    CHECK_GL_CALL(glGenTextures(1, &atlasId));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, atlasId));
+    CHECK_GL_CALL(glTexStorage3D(GL_TEXTURE_3D, levels, GL_R8, size, size, size));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, levels - 1));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    clearGPU();
+}
\ No newline at end of file
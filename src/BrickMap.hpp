@@ -0,0 +1,59 @@
+/* Brick map
+ * Sparse volume storage - a coarse indirection grid points occupied
+ * bricks into a 3D atlas, empty bricks take no atlas space */
+#pragma once
+#ifndef _BRICK_MAP_HPP_
+#define _BRICK_MAP_HPP_
+
+#include <glad/glad.h>
+
+#include "glm/glm.hpp"
+
+#include <vector>
+
+class CloudVolume;
+class BrickMap {
+    public:
+        ~BrickMap();
+
+        /* Make resident every brick a billboard sphere touches and free the rest
+         * Bricks that stay resident keep their atlas slot and freed slots are reused,
+         * the atlas is only recreated when it overflows or is mostly empty
+         * Indirection holds atlas slot + 1 per brick, 0 for empty */
+        void allocate(const CloudVolume *);
+        void release();
+
+        /* Clear the resident bricks overlapping a level 0 voxel region [min, max) */
+        void clearGPU(const glm::ivec3 &, const glm::ivec3 &);
+
+        GLuint indirectionId = 0;   // R32UI grid of bricks
+        GLuint atlasId = 0;         // R8 atlas of bricks with per-brick mips
+        int gridSize = 0;           // Bricks per side of the volume
+        int atlasBricks = 0;        // Bricks per side of the atlas
+        int levels = 0;             // Atlas mips, never coarser than one voxel per brick
+        int residentBricks = 0;
+
+        /* What the last allocate and clear changed */
+        bool repacked = false;      // Atlas was recreated, every brick needs rewriting
+        int allocatedBricks = 0;
+        int freedBricks = 0;
+        glm::ivec3 updatedMin = glm::ivec3(0);  // Atlas voxels [min, max) cleared for rewriting
+        glm::ivec3 updatedMax = glm::ivec3(0);
+
+        /* Memory actually holding voxels vs a dense volume with the same mips */
+        size_t residentBytes() const;
+        size_t atlasBytes() const;
+        static size_t denseBytes(const CloudVolume *);
+
+    private:
+        void resizeIndirection(int);
+        void resizeAtlas(int, int);
+        void clearGPU();
+
+        std::vector<GLuint> indirection;
+        std::vector<uint8_t> covered;
+        std::vector<GLuint> freeSlots;
+        int slotCount = 0;          // Slots ever handed out since the last repack
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include "Clipmap.hpp"
+
+#include "Shaders/GLSL.hpp"
+
+Clipmap::~Clipmap() {
+    for (GLuint &texture : textures) {
+        if (texture) {
+            CHECK_GL_CALL(glDeleteTextures(1, &texture));
+        }
+    }
+}
+
+float Clipmap::voxelSize(int cascade) const {
+    return baseVoxelSize * (1 << cascade);
+}
+
+/* (Re)create every cascade texture
+ * Repeat wrapping makes sampling toroidal for free */
+void Clipmap::resize(int dim, int mips) {
+    dimension = dim;
+    levels = mips;
+    for (GLuint &texture : textures) {
+        if (texture) {
+            CHECK_GL_CALL(glDeleteTextures(1, &texture));
+        }
+        CHECK_GL_CALL(glGenTextures(1, &texture));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, texture));
+        CHECK_GL_CALL(glTexStorage3D(GL_TEXTURE_3D, levels, GL_R8, dimension, dimension, dimension));
+        CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+        CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+        CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT));
+        CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT));
+        CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT));
+        for (int i = 0; i < levels; i++) {
+            CHECK_GL_CALL(glClearTexImage(texture, i, GL_RED, GL_FLOAT, nullptr));
+        }
+    }
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    invalidate();
+}
+
+void Clipmap::invalidate() {
+    for (bool &cascade : valid) {
+        cascade = false;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+/* Clipmap
+ * Nested camera-centred cascades of equal voxel count and doubling extent
+ * Cascades are addressed toroidally so moving only rewrites the entered slabs */
+#pragma once
+#ifndef _CLIPMAP_HPP_
+#define _CLIPMAP_HPP_
+
+#include <glad/glad.h>
+
+#include "glm/glm.hpp"
+
+#include <cstdint>
+
+class Clipmap {
+    public:
+        ~Clipmap();
+
+        /* Cone trace through the cascades instead of the volume */
+        bool enabled = false;
+
+        static const int MAX_CASCADES = 4;
+        int cascades = 3;
+        int dimension = 0;          // Voxels per side of every cascade
+        int levels = 0;
+        float baseVoxelSize = 0.f;  // Voxel size of the finest cascade
+        float voxelSize(int) const;
+
+        GLuint textures[MAX_CASCADES] = { 0 };
+        glm::ivec3 origins[MAX_CASCADES];       // World voxel coordinates of each cascade's min corner
+        bool valid[MAX_CASCADES] = { false };
+        uint64_t inputHash = 0;                 // Everything but camera position the cascades depend on
+        int updatedVoxels = 0;                  // Voxels rewritten by the last update
+
+        void resize(int, int);
+        void invalidate();
+};
+
+#endif
\ No newline at end of file
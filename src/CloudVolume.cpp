@@ -4,18 +4,50 @@
 #include "Util.hpp"
 #include "Shaders/GLSL.hpp"
 
+#include "glm/gtc/packing.hpp"
+
+#include <cfloat>
+#include <cstring>
+
 CloudVolume::CloudVolume(int dim, glm::vec2 bounds, glm::vec3 position, int mips) {
     this->dimension = dim;
     this->position = position;
     this->xBounds = bounds;
     this->yBounds = bounds;
     this->zBounds = bounds;
-    this->levels = mips;
+    this->requestedLevels = mips;
 
     /* Init volume */
+    allocateVolume();
+
+    /* Init instanced quad
+     * Instance buffers grow with the billboard count, so start small rather
+     * than reserving a billboard per voxel */
+    this->instancedQuad = Library::createQuad();
+    allocateInstanceBuffers(INITIAL_INSTANCE_CAPACITY);
+
+    range = glm::vec3(
+        xBounds.y - xBounds.x,
+        yBounds.y - yBounds.x,
+        zBounds.y - zBounds.x);
+    voxelSize = range / (float)dimension;
+}
+
+/* (Re)create the immutable volume texture at the current dimension
+ * Mips stop at a single voxel, sparse volumes only need the level count */
+void CloudVolume::allocateVolume() {
+    int maxLevels = 1;
+    while ((1 << (maxLevels - 1)) < dimension) {
+        maxLevels++;
+    }
+    levels = glm::min(requestedLevels, maxLevels);
+    if (sparse) {
+        return;
+    }
+
     CHECK_GL_CALL(glGenTextures(1, &volId));
     CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, volId));
-    CHECK_GL_CALL(glTexStorage3D(GL_TEXTURE_3D, mips, GL_R8, dimension, dimension, dimension)); // immutable
+    CHECK_GL_CALL(glTexStorage3D(GL_TEXTURE_3D, levels, GL_R8, dimension, dimension, dimension)); // immutable
     CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
     CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
     CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
@@ -23,66 +55,115 @@ CloudVolume::CloudVolume(int dim, glm::vec2 bounds, glm::vec3 position, int mips
     CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
     clearGPU();
     CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+}
 
-    /* Init instanced quad */
-    int numVoxels = dim * dim * dim;
-    this->instancedQuad = Library::createQuad();
-    CHECK_GL_CALL(glBindVertexArray(instancedQuad->vaoId));
-    CHECK_GL_CALL(glGenBuffers(1, &instancedQuadPosVBO));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instancedQuadPosVBO));
-    CHECK_GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * numVoxels, nullptr, GL_DYNAMIC_DRAW));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0)); 
-    CHECK_GL_CALL(glEnableVertexAttribArray(2));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instancedQuadPosVBO));
-    CHECK_GL_CALL(glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));	
-    CHECK_GL_CALL(glVertexAttribDivisor(2, 1)); 
-    CHECK_GL_CALL(glGenBuffers(1, &instancedQuadScaleVBO));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instancedQuadScaleVBO));
-    CHECK_GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * numVoxels, nullptr, GL_DYNAMIC_DRAW));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0)); 
-    CHECK_GL_CALL(glEnableVertexAttribArray(3));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instancedQuadScaleVBO));
-    CHECK_GL_CALL(glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));	
-    CHECK_GL_CALL(glVertexAttribDivisor(3, 1));
+/* Change voxel resolution at runtime
+ * Storage is immutable so the texture is replaced, anything sized by the dimension
+ * (light maps, bricks, octree, clipmap, voxel buffers) follows it on its next use */
+void CloudVolume::setDimension(int dim) {
+    if (dim == dimension || dim <= 0) {
+        return;
+    }
 
-    range = glm::vec3(
-        xBounds.y - xBounds.x,
-        yBounds.y - yBounds.x,
-        zBounds.y - zBounds.x);
+    if (volId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &volId));
+        volId = 0;
+    }
+    dimension = dim;
+    allocateVolume();
+
+    /* New volume is empty and voxels no longer line up with the old ones */
+    writtenMin = glm::ivec3(0);
+    writtenMax = glm::ivec3(0);
     voxelSize = range / (float)dimension;
 }
 
+/* Release GPU resources */
+CloudVolume::~CloudVolume() {
+    for (GLsync &fence : instanceFences) {
+        if (fence) {
+            CHECK_GL_CALL(glDeleteSync(fence));
+        }
+    }
+    CHECK_GL_CALL(glDeleteBuffers(1, &instancedQuadVBO));
+    if (volId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &volId));
+    }
+    for (Readback &readback : readbacks) {
+        if (readback.fence) {
+            CHECK_GL_CALL(glDeleteSync(readback.fence));
+        }
+        if (readback.pbo) {
+            CHECK_GL_CALL(glDeleteBuffers(1, &readback.pbo));
+        }
+    }
+
+    GLuint buffers[] = { instancedQuad->vertBufId, instancedQuad->norBufId, instancedQuad->texBufId, instancedQuad->eleBufId };
+    CHECK_GL_CALL(glDeleteBuffers(4, buffers));
+    CHECK_GL_CALL(glDeleteVertexArrays(1, &instancedQuad->vaoId));
+    delete instancedQuad;
+}
+
 /* Add a billboard */
 void CloudVolume::addCloudBoard(glm::vec3 &pos, float &scale) {
+    billboards.ids.push_back(billboards.count);
     billboards.count++;
-    billboards.positions.push_back(pos);
-    billboards.scales.push_back(scale);
+    billboards.instances.push_back(glm::vec4(pos, scale));
+    billboards.generation++;
+    billboardsDirty = true;
 }
 
-/* Sort billboards by distance to a point */
-void CloudVolume::sortBoards(glm::vec3 point) {
-    for (unsigned int i = 0; i < billboards.count; i++) {
-        int minIdx = i;
-        for (unsigned int j = i + 1; j < billboards.count; j++) {
-            if (glm::distance(this->position + billboards.positions[minIdx], point) < glm::distance(this->position + billboards.positions[j], point)) {
-                minIdx = j;
-            }
-        }
-        if (i != minIdx) {
-            glm::vec3 tmpPos = billboards.positions[i];
-            billboards.positions[i] = billboards.positions[minIdx];
-            billboards.positions[minIdx] = tmpPos;
-            float tmpScale = billboards.scales[i];
-            billboards.scales[i] = billboards.scales[minIdx];
-            billboards.scales[minIdx] = tmpScale;
+/* Remove a billboard, later ids close the gap */
+void CloudVolume::removeCloudBoard(int index) {
+    uint32_t removed = billboards.ids[index];
+    billboards.count--;
+    billboards.instances.erase(billboards.instances.begin() + index);
+    billboards.ids.erase(billboards.ids.begin() + index);
+    for (uint32_t &id : billboards.ids) {
+        if (id > removed) {
+            id--;
         }
     }
+    billboards.generation++;
+    billboardsDirty = true;
+}
+
+/* Sort billboards by distance to a point
+ * Reuses the previous order when neither the point nor the billboards changed
+ * and insertion-sort repairs it when the point only moved a little */
+void CloudVolume::sortBoards(glm::vec3 point) {
+    glm::vec3 localPoint = point - this->position;
+    bool edited = !isSorted || sortedGeneration != billboards.generation;
+
+    if (!edited && localPoint == sortedPoint) {
+        sortStats.skips++;
+        return;
+    }
+    if (!edited && glm::distance(localPoint, sortedPoint) < sortRepairDistance
+        && sorter.repair(billboards.instances, billboards.ids, localPoint)) {
+        sortStats.repairs++;
+    }
+    else {
+        sorter.sort(billboards.instances, billboards.ids, localPoint);
+        sortStats.fullSorts++;
+    }
+
+    sortedPoint = localPoint;
+    sortedGeneration = billboards.generation;
+    isSorted = true;
+    billboardsDirty = true;
 }
 
 void CloudVolume::update() {
-    /* Reupload billboard positions and scales */
+    /* Only one of the dense volume and the brick map holds voxels */
+    updateStorage();
+
+    /* Hand off finished volume readbacks */
+    pollReadbacks();
+    octree.pollCountReadback();
+
+    /* Reupload billboards if they changed */
+    uploadedBytes = 0;
     uploadBillboards();
 
     range = glm::vec3(
@@ -92,6 +173,24 @@ void CloudVolume::update() {
     voxelSize = range / (float)dimension;
 }
 
+/* Free whichever storage the sparse flag no longer uses
+ * Either way the new storage starts out empty */
+void CloudVolume::updateStorage() {
+    if (sparse == !volId) {
+        return;
+    }
+    if (sparse) {
+        CHECK_GL_CALL(glDeleteTextures(1, &volId));
+        volId = 0;
+    }
+    else {
+        bricks.release();
+        allocateVolume();
+    }
+    writtenMin = glm::ivec3(0);
+    writtenMax = glm::ivec3(0);
+}
+
 /* Reset GPU volume */
 void CloudVolume::clearGPU() {
     for (int i = 0; i < levels; i++) {
@@ -99,6 +198,102 @@ void CloudVolume::clearGPU() {
     }
 }
 
+/* Reset a level 0 region of the GPU volume */
+void CloudVolume::clearGPU(const glm::ivec3 &min, const glm::ivec3 &max) {
+    glm::ivec3 size = max - min;
+    if (size.x <= 0 || size.y <= 0 || size.z <= 0) {
+        return;
+    }
+    CHECK_GL_CALL(glClearTexSubImage(volId, 0, min.x, min.y, min.z, size.x, size.y, size.z, GL_RED, GL_FLOAT, nullptr));
+}
+
+/* Voxels any billboard sphere can touch, padded by a voxel for the
+ * voxelizer's neighbor writes and snapped out to whole bricks */
+void CloudVolume::boardVoxelBounds(glm::ivec3 &min, glm::ivec3 &max) const {
+    if (!billboards.count) {
+        min = max = glm::ivec3(0);
+        return;
+    }
+
+    glm::vec3 lo(FLT_MAX);
+    glm::vec3 hi(-FLT_MAX);
+    for (int i = 0; i < billboards.count; i++) {
+        const glm::vec4 &board = billboards.instances[i];
+        float radius = board.w * fluffiness;
+        lo = glm::min(lo, glm::vec3(board) - radius);
+        hi = glm::max(hi, glm::vec3(board) + radius);
+    }
+
+    glm::vec3 boundsMin(xBounds.x, yBounds.x, zBounds.x);
+    glm::ivec3 voxelMin = glm::ivec3(glm::floor((lo - boundsMin) / voxelSize)) - 1;
+    glm::ivec3 voxelMax = glm::ivec3(glm::ceil((hi - boundsMin) / voxelSize)) + 1;
+    voxelMin = (glm::max(voxelMin, 0) / BRICK_SIZE) * BRICK_SIZE;
+    voxelMax = ((glm::min(voxelMax, dimension) + BRICK_SIZE - 1) / BRICK_SIZE) * BRICK_SIZE;
+    min = glm::min(voxelMin, dimension);
+    max = glm::max(glm::min(voxelMax, dimension), min);
+}
+
+/* Queue a copy of level 0 into the next free pack buffer
+ * Returns false if every buffer in the ring is still in flight or the volume is sparse */
+bool CloudVolume::requestReadback(ReadbackCallback callback) {
+    if (!volId || readbackCount == READBACK_RING_SIZE) {
+        return false;
+    }
+    Readback &readback = readbacks[(readbackHead + readbackCount) % READBACK_RING_SIZE];
+    readbackCount++;
+
+    /* (Re)allocate if the volume outgrew this buffer */
+    GLsizeiptr size = (GLsizeiptr)dimension * dimension * dimension;
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    if (size > readback.size) {
+        if (readback.pbo) {
+            CHECK_GL_CALL(glDeleteBuffers(1, &readback.pbo));
+        }
+        readback.size = size;
+        CHECK_GL_CALL(glGenBuffers(1, &readback.pbo));
+        CHECK_GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo));
+        CHECK_GL_CALL(glBufferStorage(GL_PIXEL_PACK_BUFFER, size, nullptr, flags));
+        readback.mapped = (uint8_t *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, flags);
+    }
+    readback.dimension = dimension;
+    readback.callback = callback;
+
+    /* Image stores must land before the texture is read */
+    CHECK_GL_CALL(glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT));
+    CHECK_GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo));
+    CHECK_GL_CALL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, volId));
+    CHECK_GL_CALL(glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    CHECK_GL_CALL(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+    CHECK_GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    return true;
+}
+
+/* Deliver finished readbacks in request order without blocking */
+void CloudVolume::pollReadbacks() {
+    while (readbackCount) {
+        Readback &readback = readbacks[readbackHead];
+        GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            return;
+        }
+        CHECK_GL_CALL(glDeleteSync(readback.fence));
+        readback.fence = 0;
+        readback.callback(readback.mapped, readback.dimension);
+        readback.callback = nullptr;
+
+        readbackHead = (readbackHead + 1) % READBACK_RING_SIZE;
+        readbackCount--;
+    }
+}
+
+int CloudVolume::pendingReadbacks() const {
+    return readbackCount;
+}
+
 // Assume 4 bytes per voxel
 glm::ivec3 CloudVolume::get3DIndices(const int index) const {
 	int line = dimension;
@@ -122,9 +317,10 @@ void CloudVolume::regenerateBillboards(int count, glm::vec3 minOffset, glm::vec3
     billboards.maxOffset = maxOffset;
     billboards.minScale = minScale;
     billboards.maxScale = maxScale;
-    billboards.positions.clear();
-    billboards.scales.clear();
+    billboards.instances.clear();
+    billboards.ids.clear();
     billboards.count = 0;
+    billboards.generation++;
     for (int i = 0; i < count; i++) {
         glm::vec3 position = Util::genRandomVec3(minOffset.x, maxOffset.x, minOffset.y, maxOffset.y, minOffset.z, maxOffset.z);
         float scale = Util::genRandom(minScale, maxScale);
@@ -137,28 +333,123 @@ void CloudVolume::resetBillboards() {
 }
 
 void CloudVolume::uploadBillboards() {
-    if (!billboards.count) {
+    /* Catch edits made directly to billboard data */
+    billboardsDirty |= uploadedGeneration != billboards.generation;
+    billboardsDirty |= uploadedHalfFloat != halfFloatInstances;
+    if (!billboardsDirty || !billboards.count) {
         return;
     }
-    
-    CHECK_GL_CALL(glBindVertexArray(instancedQuad->vaoId));
 
-    /* Reupload billboard positions */
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instancedQuadPosVBO));
-    CHECK_GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * billboards.positions.size(), &billboards.positions[0], GL_DYNAMIC_DRAW));
+    if (billboards.count > instanceCapacity) {
+        allocateInstanceBuffers(glm::max(billboards.count, 2 * instanceCapacity));
+    }
+
+    /* Fence the region we're leaving behind every draw that reads it */
+    instanceFences[instanceRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
-    /* Reupload billboard scales */
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instancedQuadScaleVBO));
-    std::vector<float> scales;
-    if (fluffiness != 1.f) {
-        for (float scale : billboards.scales) {
-            scales.push_back(scale * fluffiness);
+    /* Move to the next region and wait until the GPU is done with it */
+    instanceRegion = (instanceRegion + 1) % INSTANCE_RING_SIZE;
+    GLsync &fence = instanceFences[instanceRegion];
+    if (fence) {
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        CHECK_GL_CALL(glDeleteSync(fence));
+        fence = 0;
+    }
+
+    /* Write straight into coherent mapped memory */
+    uint8_t *region = mappedInstances + instanceOffset();
+    if (halfFloatInstances) {
+        glm::uvec2 *packed = (glm::uvec2 *) region;
+        for (int i = 0; i < billboards.count; i++) {
+            const glm::vec4 &board = billboards.instances[i];
+            packed[i].x = glm::packHalf2x16(glm::vec2(board.x, board.y));
+            packed[i].y = glm::packHalf2x16(glm::vec2(board.z, board.w));
         }
+        uploadedBytes += sizeof(glm::uvec2) * billboards.count;
     }
     else {
-        scales = billboards.scales;
+        std::memcpy(region, billboards.instances.data(), sizeof(glm::vec4) * billboards.count);
+        uploadedBytes += sizeof(glm::vec4) * billboards.count;
+    }
+    std::memcpy(region + idsOffset(), billboards.ids.data(), sizeof(uint32_t) * billboards.count);
+    uploadedBytes += sizeof(uint32_t) * billboards.count;
+    pointInstanceAttributes();
+
+    billboardsDirty = false;
+    uploadedGeneration = billboards.generation;
+    uploadedHalfFloat = halfFloatInstances;
+}
+
+static const GLsizeiptr SSBO_ALIGNMENT = 256;
+
+/* Ring regions always fit full floats plus ids and are padded so every region
+ * and id offset satisfies SSBO offset alignment */
+GLsizeiptr CloudVolume::regionStride() const {
+    GLsizeiptr ids = sizeof(uint32_t) * instanceCapacity;
+    return idsOffset() + (ids + SSBO_ALIGNMENT - 1) / SSBO_ALIGNMENT * SSBO_ALIGNMENT;
+}
+
+GLsizeiptr CloudVolume::idsOffset() const {
+    return (sizeof(glm::vec4) * instanceCapacity + SSBO_ALIGNMENT - 1) / SSBO_ALIGNMENT * SSBO_ALIGNMENT;
+}
+
+GLintptr CloudVolume::instanceOffset() const {
+    return instanceRegion * regionStride();
+}
+
+/* Bind the current region of the instance buffer as an SSBO */
+void CloudVolume::bindBillboardBuffer(GLuint binding) const {
+    CHECK_GL_CALL(glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, instancedQuadVBO, instanceOffset(), idsOffset()));
+}
+
+/* Bind the ids of the current region as an SSBO */
+void CloudVolume::bindBillboardIds(GLuint binding) const {
+    CHECK_GL_CALL(glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, instancedQuadVBO, instanceOffset() + idsOffset(), regionStride() - idsOffset()));
+}
+
+/* (Re)create the immutable, persistently mapped instance buffer */
+void CloudVolume::allocateInstanceBuffers(int capacity) {
+    /* Old buffer is released once the GPU is done with it */
+    if (instanceCapacity) {
+        CHECK_GL_CALL(glDeleteBuffers(1, &instancedQuadVBO));
+    }
+    for (GLsync &fence : instanceFences) {
+        if (fence) {
+            CHECK_GL_CALL(glDeleteSync(fence));
+            fence = 0;
+        }
     }
-    CHECK_GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * scales.size(), &scales[0], GL_DYNAMIC_DRAW));
+    instanceCapacity = capacity;
+    instanceRegion = 0;
 
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr size = regionStride() * INSTANCE_RING_SIZE;
+    CHECK_GL_CALL(glGenBuffers(1, &instancedQuadVBO));
+    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instancedQuadVBO));
+    CHECK_GL_CALL(glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags));
+    mappedInstances = (uint8_t *) glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+    CHECK_GL_CALL(glBindVertexArray(instancedQuad->vaoId));
+    CHECK_GL_CALL(glEnableVertexAttribArray(2));
+    CHECK_GL_CALL(glVertexAttribDivisor(2, 1));
+    CHECK_GL_CALL(glBindVertexArray(0));
+    pointInstanceAttributes();
+
+    /* Everything has to be rewritten into the new storage */
+    billboardsDirty = true;
+}
+
+/* Point the instance attribute at the current ring region */
+void CloudVolume::pointInstanceAttributes() {
+    CHECK_GL_CALL(glBindVertexArray(instancedQuad->vaoId));
+    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instancedQuadVBO));
+    if (halfFloatInstances) {
+        CHECK_GL_CALL(glVertexAttribPointer(2, 4, GL_HALF_FLOAT, GL_FALSE, sizeof(glm::uvec2), (void*)instanceOffset()));
+    }
+    else {
+        CHECK_GL_CALL(glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)instanceOffset()));
+    }
+    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
     CHECK_GL_CALL(glBindVertexArray(0));
 }
@@ -6,28 +6,49 @@
 
 #include "glm/glm.hpp"
 
+#include "BillboardSorter.hpp"
+#include "BrickMap.hpp"
+#include "Clipmap.hpp"
+#include "LightVolume.hpp"
+#include "SparseOctree.hpp"
+
+#include <functional>
 #include <vector>
 
 class Mesh;
 class CloudVolume {
     public:
         struct Billboards {
-            std::vector<glm::vec3> positions;
-            std::vector<float> scales;
+            std::vector<glm::vec4> instances;   // xyz local position, w scale
+            std::vector<uint32_t> ids;          // Stable index of each instance, [0, count) and kept through sorts
 
             int count = 0;
             glm::vec3 minOffset = glm::vec3(-1.f);
             glm::vec3 maxOffset = glm::vec3(1.f);
             float minScale = 1.f;
             float maxScale = 1.f;
+
+            /* Bumped whenever billboards are added, removed, or edited */
+            unsigned int generation = 0;
+        };
+
+        /* Frame counts of each kind of billboard sort */
+        struct SortStats {
+            int fullSorts = 0;
+            int repairs = 0;
+            int skips = 0;
         };
 
         CloudVolume(int, glm::vec2, glm::vec3, int);
+        ~CloudVolume();
 
         void update();
+        void setDimension(int);
         void clearGPU();
+        void clearGPU(const glm::ivec3 &, const glm::ivec3 &);
 
         void addCloudBoard(glm::vec3 &, float &);
+        void removeCloudBoard(int);
         void sortBoards(glm::vec3);
 
         glm::vec3 position;     // cloud object position
@@ -38,20 +59,106 @@ class CloudVolume {
         int dimension;          // Voxels per dimension 
         glm::vec3 range;
         glm::vec3 voxelSize;    // World-size of individual voxels
-        int levels;             // Mipmap levels
+        int levels;             // Mipmap levels, at most enough to reach one voxel
 
+        /* Billboards stream as one packed vec4(position, scale) per instance,
+         * followed in each region by the instances' ids
+         * The instance buffer is persistently mapped and split into a ring of
+         * regions so the CPU never writes a region the GPU may still read */
+        static const int INSTANCE_RING_SIZE = 3;
+        static const int INITIAL_INSTANCE_CAPACITY = 1024;
         Mesh * instancedQuad;
-        GLuint instancedQuadPosVBO;
-        GLuint instancedQuadScaleVBO;
+        GLuint instancedQuadVBO;
+        int instanceCapacity = 0;           // Billboards per ring region
+        int instanceRegion = 0;             // Region read by this frame's draws
+        int uploadedBytes = 0;              // Bytes written to instance buffers this frame
+        bool halfFloatInstances = false;    // Stream instances as 4 half floats
+        GLintptr instanceOffset() const;
+        void bindBillboardBuffer(GLuint) const;
+        void bindBillboardIds(GLuint) const;
+        static const GLuint BOARD_ID_BINDING = 7;
+
         Billboards billboards;
+        BillboardSorter sorter;
+        SortStats sortStats;
+        float sortRepairDistance = 1.f;     // Sort point movement repaired in place rather than re-sorted
         void uploadBillboards();
         void regenerateBillboards(int, glm::vec3, glm::vec3, float, float);
         void resetBillboards();
-        float fluffiness = 1.f;
+        float fluffiness = 1.f;             // Billboard scale multiplier applied in the vertex shader
 
-        GLuint volId;
+        GLuint volId = 0;                   // Dense volume, 0 while sparse
+        unsigned int voxelGeneration = 0;   // Bumped whenever the voxelizer rewrites the volume
         glm::ivec3 get3DIndices(int) const;
+
+        /* Level 0 voxel regions [min, max) snapped out to bricks
+         * written holds whatever the last voxelization left in the volume */
+        static const int BRICK_SIZE = 8;
+        void boardVoxelBounds(glm::ivec3 &, glm::ivec3 &) const;
+        glm::ivec3 writtenMin = glm::ivec3(0);
+        glm::ivec3 writtenMax = glm::ivec3(0);
+
+        /* Store voxels in a sparse brick map instead of the dense volume
+         * The dense volume is freed while sparse and the brick map while dense,
+         * storage follows the flag on the next update
+         * Readbacks and precomputed light only cover the dense volume */
+        bool sparse = false;
+        BrickMap bricks;
+
+        /* Optional sparse voxel octree over the voxelized volume */
+        SparseOctree octree;
+
+        /* Optional camera-centred cascades for cloud fields larger than the volume */
+        Clipmap clipmap;
+
+        /* Optional precomputed transmittance toward the sun */
+        LightVolume light;
+
+        /* Asynchronous level 0 readback
+         * Snapshots are copied in native R8 into a ring of pixel pack buffers and
+         * handed to their callback once the GPU is done, a few frames later
+         * Callback receives the voxels and the dimension they were read at,
+         * the voxel pointer is only valid during the callback */
+        typedef std::function<void(const uint8_t *, int)> ReadbackCallback;
+        static const int READBACK_RING_SIZE = 3;
+        bool requestReadback(ReadbackCallback);
+        void pollReadbacks();
+        int pendingReadbacks() const;
         glm::vec3 reverseVoxelIndex(const glm::ivec3 &) const;
+
+    private:
+        void allocateVolume();
+        void updateStorage();
+        int requestedLevels;
+
+        /* State of the last sort, billboards are kept in this order */
+        glm::vec3 sortedPoint;
+        unsigned int sortedGeneration = 0;
+        bool isSorted = false;
+
+        /* Instance streaming */
+        void allocateInstanceBuffers(int);
+        void pointInstanceAttributes();
+        GLsizeiptr regionStride() const;
+        GLsizeiptr idsOffset() const;
+        uint8_t * mappedInstances = nullptr;
+        GLsync instanceFences[INSTANCE_RING_SIZE] = { 0 };
+        bool billboardsDirty = true;
+        unsigned int uploadedGeneration = 0;
+        bool uploadedHalfFloat = false;
+
+        /* Volume readback */
+        struct Readback {
+            GLuint pbo = 0;
+            GLsizeiptr size = 0;
+            uint8_t * mapped = nullptr;
+            GLsync fence = 0;
+            int dimension = 0;
+            ReadbackCallback callback;
+        };
+        Readback readbacks[READBACK_RING_SIZE];
+        int readbackHead = 0;               // Oldest in-flight readback
+        int readbackCount = 0;
 };
 
 #endif
@@ -0,0 +1,26 @@
+#include "LightVolume.hpp"
+
+#include "Shaders/GLSL.hpp"
+
+LightVolume::~LightVolume() {
+    if (textureId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &textureId));
+    }
+}
+
+/* Immutable so recreated, clamped so samples outside the light's frustum stay lit */
+void LightVolume::resize(int dim) {
+    size = dim;
+    if (textureId) {
+        CHECK_GL_CALL(glDeleteTextures(1, &textureId));
+    }
+    CHECK_GL_CALL(glGenTextures(1, &textureId));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, textureId));
+    CHECK_GL_CALL(glTexStorage3D(GL_TEXTURE_3D, 1, GL_R16F, size, size, size));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+/* Light volume
+ * Transmittance toward the sun stored in a volume aligned with the light's
+ * orthographic projection so shading is a single fetch instead of a cone trace */
+#pragma once
+#ifndef _LIGHT_VOLUME_HPP_
+#define _LIGHT_VOLUME_HPP_
+
+#include <glad/glad.h>
+
+#include "glm/glm.hpp"
+
+class LightVolume {
+    public:
+        ~LightVolume();
+
+        /* Rebuild after voxelization and shade from it instead of cone tracing
+         * Built from the dense volume only */
+        bool enabled = false;
+
+        GLuint textureId = 0;       // R16F transmittance, z slices step away from the light
+        int size = 0;               // Texels per side
+        glm::mat4 lightPV;          // Light projection the volume was built with
+        float extinction = 0.5f;    // Optical depth per voxel of full density
+
+        void resize(int);
+};
+
+#endif
\ No newline at end of file
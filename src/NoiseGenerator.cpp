@@ -0,0 +1,503 @@
+#include "NoiseGenerator.hpp"
+
+#include "Util.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+/* SSE2 is baseline on x64 and on x86 builds targeting it
+ * Neither SSE2 nor MSVC's auto-vectorizer handles the cell gathers, so the row
+ * kernels gather into registers by hand and do the arithmetic four texels wide */
+#if !defined(NOISE_NO_SIMD) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__))
+#define NOISE_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Where each texel along an axis falls in the lattice
+ * The volume is a cube so one table serves x, y, and z */
+struct LatticeAxis {
+    std::vector<int> c0, c1;        // Cell below and above, wrapped
+    std::vector<float> f;           // Offset into the cell
+    std::vector<float> w;           // Quintic fade of the offset
+    std::vector<int> prev, next;    // Wrapped neighbour texels
+    std::vector<int> cellPrev, cellNext;
+};
+
+/* Per-cell random values, x fastest */
+struct Lattice {
+    int period;
+    std::vector<float> a, b, c;     // Value, gradient, or feature point
+};
+
+static inline float fade(float t) {
+    return t * t * t * (t * (t * 6.f - 15.f) + 10.f);
+}
+
+/* Hash to [0, 1) */
+static inline float unitFloat(uint32_t h) {
+    return (h >> 8) * (1.f / 16777216.f);
+}
+
+static inline int8_t toSnorm(float v) {
+    return (int8_t)(std::max(-1.f, std::min(1.f, v)) * 127.f);
+}
+
+#ifdef NOISE_SSE2
+/* Four table entries at four indices */
+static inline __m128 gather4(const float *table, const int *index) {
+    return _mm_set_ps(table[index[3]], table[index[2]], table[index[1]], table[index[0]]);
+}
+
+/* 32-bit multiply, SSE2 only has the widening even-lane form */
+static inline __m128i mullo4(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i xorShift4(__m128i h, int shift) {
+    return _mm_xor_si128(h, _mm_srli_epi32(h, shift));
+}
+
+static inline __m128i toSnorm4(__m128 v) {
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.f)), _mm_set1_ps(1.f));
+    return _mm_cvttps_epi32(_mm_mul_ps(v, _mm_set1_ps(127.f)));
+}
+#endif
+
+static LatticeAxis buildAxis(int dim, int period) {
+    LatticeAxis axis;
+    axis.c0.resize(dim);
+    axis.c1.resize(dim);
+    axis.f.resize(dim);
+    axis.w.resize(dim);
+    axis.prev.resize(dim);
+    axis.next.resize(dim);
+    for (int i = 0; i < dim; i++) {
+        float u = i * period / (float) dim;
+        int cell = std::min((int) u, period - 1);
+        axis.c0[i] = cell;
+        axis.c1[i] = (cell + 1) % period;
+        axis.f[i] = u - cell;
+        axis.w[i] = fade(axis.f[i]);
+        axis.prev[i] = (i + dim - 1) % dim;
+        axis.next[i] = (i + 1) % dim;
+    }
+    axis.cellPrev.resize(period);
+    axis.cellNext.resize(period);
+    for (int i = 0; i < period; i++) {
+        axis.cellPrev[i] = (i + period - 1) % period;
+        axis.cellNext[i] = (i + 1) % period;
+    }
+    return axis;
+}
+
+/* Value noise keeps a scalar per cell, Perlin a unit cube edge gradient,
+ * and Worley a feature point inside the cell */
+static Lattice buildLattice(NoiseGenerator::Basis basis, int period, uint32_t seed) {
+    static const float GRADIENTS[12][3] = {
+        { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+        { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+        { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 }
+    };
+
+    Lattice lattice;
+    lattice.period = period;
+    const int cells = period * period * period;
+    lattice.a.resize(cells);
+    lattice.b.resize(cells);
+    lattice.c.resize(cells);
+    for (int z = 0; z < period; z++) {
+        for (int y = 0; y < period; y++) {
+            for (int x = 0; x < period; x++) {
+                int i = x + (y + z * period) * period;
+                uint32_t h = NoiseGenerator::hash(x, y, z, seed);
+                if (basis == NoiseGenerator::PERLIN) {
+                    const float *g = GRADIENTS[h % 12];
+                    lattice.a[i] = g[0];
+                    lattice.b[i] = g[1];
+                    lattice.c[i] = g[2];
+                }
+                else if (basis == NoiseGenerator::WORLEY) {
+                    lattice.a[i] = unitFloat(h);
+                    lattice.b[i] = unitFloat(NoiseGenerator::hash(h, 1, 0, seed));
+                    lattice.c[i] = unitFloat(NoiseGenerator::hash(h, 2, 0, seed));
+                }
+                else {
+                    lattice.a[i] = unitFloat(h) * 2.f - 1.f;
+                }
+            }
+        }
+    }
+    return lattice;
+}
+
+/* Row kernels
+ * Everything that only depends on y and z is folded into a table with one entry
+ * per lattice cell along x, leaving a gather and a few multiply-adds per texel */
+struct RowScratch {
+    std::vector<float> a, b;
+};
+
+static void whiteRow(const LatticeAxis &axis, uint32_t seed, int y, int z, float *out) {
+    const int dim = (int) axis.f.size();
+    int x = 0;
+#ifdef NOISE_SSE2
+    /* NoiseGenerator::hash with the y and z terms folded once per row */
+    const __m128i rowSeed = _mm_set1_epi32((int) (seed ^ ((uint32_t) y * 0xd8163841u) ^ ((uint32_t) z * 0xcb1ab31fu)));
+    const __m128 scale = _mm_set1_ps(2.f / 16777216.f);
+    for (; x + 4 <= dim; x += 4) {
+        __m128i h = _mm_xor_si128(rowSeed, mullo4(_mm_setr_epi32(x, x + 1, x + 2, x + 3), _mm_set1_epi32((int) 0x8da6b343u)));
+        h = xorShift4(h, 16);
+        h = mullo4(h, _mm_set1_epi32((int) 0x7feb352du));
+        h = xorShift4(h, 15);
+        h = mullo4(h, _mm_set1_epi32((int) 0x846ca68bu));
+        h = xorShift4(h, 16);
+        __m128 unit = _mm_cvtepi32_ps(_mm_srli_epi32(h, 8));
+        _mm_storeu_ps(out + x, _mm_sub_ps(_mm_mul_ps(unit, scale), _mm_set1_ps(1.f)));
+    }
+#endif
+    for (; x < dim; x++) {
+        out[x] = unitFloat(NoiseGenerator::hash(x, y, z, seed)) * 2.f - 1.f;
+    }
+}
+
+static void valueRow(const Lattice &lattice, const LatticeAxis &axis, RowScratch &scratch, int y, int z, float *out) {
+    const int p = lattice.period;
+    const int dim = (int) axis.f.size();
+    const float wy = axis.w[y];
+    const float wz = axis.w[z];
+    const float *l00 = &lattice.a[(axis.c0[y] + axis.c0[z] * p) * p];
+    const float *l10 = &lattice.a[(axis.c1[y] + axis.c0[z] * p) * p];
+    const float *l01 = &lattice.a[(axis.c0[y] + axis.c1[z] * p) * p];
+    const float *l11 = &lattice.a[(axis.c1[y] + axis.c1[z] * p) * p];
+
+    /* Collapse y and z */
+    float *plane = scratch.a.data();
+    for (int cx = 0; cx < p; cx++) {
+        float v0 = l00[cx] + (l10[cx] - l00[cx]) * wy;
+        float v1 = l01[cx] + (l11[cx] - l01[cx]) * wy;
+        plane[cx] = v0 + (v1 - v0) * wz;
+    }
+
+    int x = 0;
+#ifdef NOISE_SSE2
+    for (; x + 4 <= dim; x += 4) {
+        __m128 v0 = gather4(plane, &axis.c0[x]);
+        __m128 v1 = gather4(plane, &axis.c1[x]);
+        __m128 w = _mm_loadu_ps(&axis.w[x]);
+        _mm_storeu_ps(out + x, _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), w)));
+    }
+#endif
+    for (; x < dim; x++) {
+        float v0 = plane[axis.c0[x]];
+        float v1 = plane[axis.c1[x]];
+        out[x] = v0 + (v1 - v0) * axis.w[x];
+    }
+}
+
+/* Each corner contributes gx * (fx - dx) + gy * (fy - dy) + gz * (fz - dz)
+ * Weighting the four y/z corners up front leaves a line in fx per cell */
+static void perlinRow(const Lattice &lattice, const LatticeAxis &axis, RowScratch &scratch, int y, int z, float *out) {
+    const int p = lattice.period;
+    const int dim = (int) axis.f.size();
+    float *slope = scratch.a.data();
+    float *offset = scratch.b.data();
+    std::fill(slope, slope + p, 0.f);
+    std::fill(offset, offset + p, 0.f);
+
+    for (int dz = 0; dz < 2; dz++) {
+        for (int dy = 0; dy < 2; dy++) {
+            const int row = ((dy ? axis.c1[y] : axis.c0[y]) + (dz ? axis.c1[z] : axis.c0[z]) * p) * p;
+            const float *gx = &lattice.a[row];
+            const float *gy = &lattice.b[row];
+            const float *gz = &lattice.c[row];
+            const float oy = axis.f[y] - dy;
+            const float oz = axis.f[z] - dz;
+            const float weight = (dy ? axis.w[y] : 1.f - axis.w[y]) * (dz ? axis.w[z] : 1.f - axis.w[z]);
+            for (int cx = 0; cx < p; cx++) {
+                slope[cx] += weight * gx[cx];
+                offset[cx] += weight * (gy[cx] * oy + gz[cx] * oz);
+            }
+        }
+    }
+
+    int x = 0;
+#ifdef NOISE_SSE2
+    for (; x + 4 <= dim; x += 4) {
+        const __m128 fx = _mm_loadu_ps(&axis.f[x]);
+        __m128 n0 = _mm_add_ps(_mm_mul_ps(gather4(slope, &axis.c0[x]), fx), gather4(offset, &axis.c0[x]));
+        __m128 n1 = _mm_add_ps(_mm_mul_ps(gather4(slope, &axis.c1[x]), _mm_sub_ps(fx, _mm_set1_ps(1.f))), gather4(offset, &axis.c1[x]));
+        _mm_storeu_ps(out + x, _mm_add_ps(n0, _mm_mul_ps(_mm_sub_ps(n1, n0), _mm_loadu_ps(&axis.w[x]))));
+    }
+#endif
+    for (; x < dim; x++) {
+        const float fx = axis.f[x];
+        float n0 = slope[axis.c0[x]] * fx + offset[axis.c0[x]];
+        float n1 = slope[axis.c1[x]] * (fx - 1.f) + offset[axis.c1[x]];
+        out[x] = n0 + (n1 - n0) * axis.w[x];
+    }
+}
+
+/* Inverted F1 - distance to the nearest feature point in the 27 surrounding cells
+ * The 9 y/z neighbours of every x cell are gathered once per row, padded to 12
+ * with candidates too far to win so each cell is three full SSE registers */
+static const int WORLEY_STRIDE = 12;
+
+static void worleyRow(const Lattice &lattice, const LatticeAxis &axis, RowScratch &scratch, int y, int z, float *out) {
+    const int p = lattice.period;
+    const int dim = (int) axis.f.size();
+    const int cy = axis.c0[y];
+    const int cz = axis.c0[z];
+    const int ny[3] = { axis.cellPrev[cy], cy, axis.cellNext[cy] };
+    const int nz[3] = { axis.cellPrev[cz], cz, axis.cellNext[cz] };
+
+    /* Per x cell, 9 candidates of x offset and squared y/z distance */
+    float *px = scratch.a.data();
+    float *dyz = scratch.b.data();
+    for (int cx = 0; cx < p; cx++) {
+        for (int k = 9; k < WORLEY_STRIDE; k++) {
+            px[cx * WORLEY_STRIDE + k] = 0.f;
+            dyz[cx * WORLEY_STRIDE + k] = 16.f;
+        }
+    }
+    for (int k = 0; k < 9; k++) {
+        const int dy = k % 3;
+        const int dz = k / 3;
+        const int row = (ny[dy] + nz[dz] * p) * p;
+        const float oy = (float) (dy - 1) - axis.f[y];
+        const float oz = (float) (dz - 1) - axis.f[z];
+        for (int cx = 0; cx < p; cx++) {
+            float ey = oy + lattice.b[row + cx];
+            float ez = oz + lattice.c[row + cx];
+            px[cx * WORLEY_STRIDE + k] = lattice.a[row + cx];
+            dyz[cx * WORLEY_STRIDE + k] = ey * ey + ez * ez;
+        }
+    }
+
+    for (int x = 0; x < dim; x++) {
+        const int cx = axis.c0[x];
+        const int nx[3] = { axis.cellPrev[cx], cx, axis.cellNext[cx] };
+        float best = 3.f;
+#ifdef NOISE_SSE2
+        __m128 best4 = _mm_set1_ps(best);
+        for (int dx = 0; dx < 3; dx++) {
+            const __m128 ox = _mm_set1_ps((float) (dx - 1) - axis.f[x]);
+            const float *cpx = &px[nx[dx] * WORLEY_STRIDE];
+            const float *cdyz = &dyz[nx[dx] * WORLEY_STRIDE];
+            for (int k = 0; k < WORLEY_STRIDE; k += 4) {
+                __m128 ex = _mm_add_ps(ox, _mm_loadu_ps(cpx + k));
+                best4 = _mm_min_ps(best4, _mm_add_ps(_mm_mul_ps(ex, ex), _mm_loadu_ps(cdyz + k)));
+            }
+        }
+        best4 = _mm_min_ps(best4, _mm_shuffle_ps(best4, best4, _MM_SHUFFLE(1, 0, 3, 2)));
+        best4 = _mm_min_ps(best4, _mm_shuffle_ps(best4, best4, _MM_SHUFFLE(2, 3, 0, 1)));
+        best = _mm_cvtss_f32(best4);
+#else
+        for (int dx = 0; dx < 3; dx++) {
+            const float ox = (float) (dx - 1) - axis.f[x];
+            const float *cpx = &px[nx[dx] * WORLEY_STRIDE];
+            const float *cdyz = &dyz[nx[dx] * WORLEY_STRIDE];
+            for (int k = 0; k < 9; k++) {
+                float ex = ox + cpx[k];
+                best = std::min(best, ex * ex + cdyz[k]);
+            }
+        }
+#endif
+        out[x] = 1.f - 2.f * std::min(std::sqrt(best), 1.f);
+    }
+}
+
+static unsigned int sliceWorkers(int dim) {
+    return std::min((unsigned int) dim, std::max(1u, std::thread::hardware_concurrency()));
+}
+
+/* Fill a scalar field one z slice at a time, slices interleaved across workers */
+static void fillField(NoiseGenerator::Basis basis, const LatticeAxis &axis, int period, uint32_t seed, std::vector<float> &field) {
+    const int dim = (int) axis.f.size();
+    const Lattice lattice = buildLattice(basis, period, seed);
+    const unsigned int workers = sliceWorkers(dim);
+    Util::parallelFor(workers, [&](unsigned int t) {
+        RowScratch scratch;
+        scratch.a.resize(period * WORLEY_STRIDE);
+        scratch.b.resize(period * WORLEY_STRIDE);
+        for (int z = t; z < dim; z += workers) {
+            for (int y = 0; y < dim; y++) {
+                float *out = &field[(y + z * dim) * (size_t) dim];
+                switch (basis) {
+                    case NoiseGenerator::VALUE:
+                        valueRow(lattice, axis, scratch, y, z, out);
+                        break;
+                    case NoiseGenerator::PERLIN:
+                        perlinRow(lattice, axis, scratch, y, z, out);
+                        break;
+                    case NoiseGenerator::WORLEY:
+                        worleyRow(lattice, axis, scratch, y, z, out);
+                        break;
+                    default:
+                        whiteRow(axis, seed, y, z, out);
+                        break;
+                }
+            }
+        }
+    });
+}
+
+/* Central differences along one row of a wrapped field */
+static void rowGradient(const std::vector<float> &field, const LatticeAxis &axis, int y, int z, float *gx, float *gy, float *gz) {
+    const int dim = (int) axis.f.size();
+    const float *row = &field[(y + z * dim) * (size_t) dim];
+    const float *yMinus = &field[(axis.prev[y] + z * dim) * (size_t) dim];
+    const float *yPlus = &field[(axis.next[y] + z * dim) * (size_t) dim];
+    const float *zMinus = &field[(y + axis.prev[z] * dim) * (size_t) dim];
+    const float *zPlus = &field[(y + axis.next[z] * dim) * (size_t) dim];
+    /* Only the two end texels wrap along x */
+    int x = 0;
+#ifdef NOISE_SSE2
+    gx[0] = row[axis.next[0]] - row[axis.prev[0]];
+    gy[0] = yPlus[0] - yMinus[0];
+    gz[0] = zPlus[0] - zMinus[0];
+    for (x = 1; x + 4 < dim; x += 4) {
+        _mm_storeu_ps(gx + x, _mm_sub_ps(_mm_loadu_ps(row + x + 1), _mm_loadu_ps(row + x - 1)));
+        _mm_storeu_ps(gy + x, _mm_sub_ps(_mm_loadu_ps(yPlus + x), _mm_loadu_ps(yMinus + x)));
+        _mm_storeu_ps(gz + x, _mm_sub_ps(_mm_loadu_ps(zPlus + x), _mm_loadu_ps(zMinus + x)));
+    }
+#endif
+    for (; x < dim; x++) {
+        gx[x] = row[axis.next[x]] - row[axis.prev[x]];
+        gy[x] = yPlus[x] - yMinus[x];
+        gz[x] = zPlus[x] - zMinus[x];
+    }
+}
+
+static void packRow(const float *vx, const float *vy, const float *vz, const float *density, int dim, NoiseGenerator::Texel *out) {
+    int x = 0;
+#ifdef NOISE_SSE2
+    for (; x + 4 <= dim; x += 4) {
+        __m128 nx = _mm_loadu_ps(vx + x);
+        __m128 ny = _mm_loadu_ps(vy + x);
+        __m128 nz = _mm_loadu_ps(vz + x);
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+        __m128 inv = _mm_and_ps(_mm_cmpgt_ps(length, _mm_setzero_ps()), _mm_div_ps(_mm_set1_ps(1.f), length));
+
+        /* Saturating packs give rrrr bbbb gggg aaaa, two interleaves make it rgba */
+        __m128i rb = _mm_packs_epi32(toSnorm4(_mm_mul_ps(nx, inv)), toSnorm4(_mm_mul_ps(nz, inv)));
+        __m128i ga = _mm_packs_epi32(toSnorm4(_mm_mul_ps(ny, inv)), toSnorm4(_mm_loadu_ps(density + x)));
+        __m128i planar = _mm_packs_epi16(rb, ga);
+        __m128i paired = _mm_unpacklo_epi8(planar, _mm_srli_si128(planar, 8));
+        __m128i texels = _mm_unpacklo_epi16(paired, _mm_srli_si128(paired, 8));
+        _mm_storeu_si128((__m128i *) (out + x), texels);
+    }
+#endif
+    for (; x < dim; x++) {
+        float length = std::sqrt(vx[x] * vx[x] + vy[x] * vy[x] + vz[x] * vz[x]);
+        float inv = length > 0.f ? 1.f / length : 0.f;
+        out[x].r = toSnorm(vx[x] * inv);
+        out[x].g = toSnorm(vy[x] * inv);
+        out[x].b = toSnorm(vz[x] * inv);
+        out[x].a = toSnorm(density[x]);
+    }
+}
+
+void NoiseGenerator::generate(const Params &params, std::vector<Texel> &texels) {
+    const int dim = params.dimension;
+    const size_t count = (size_t) dim * dim * dim;
+    const int period = params.basis == WHITE ? dim : std::max(1, std::min(params.period, dim));
+    const LatticeAxis axis = buildAxis(dim, period);
+    texels.resize(count);
+
+    /* Curl takes three Perlin potentials, the first doubling as density */
+    std::vector<float> density(count);
+    std::vector<float> potentialY, potentialZ;
+    if (params.basis == CURL) {
+        potentialY.resize(count);
+        potentialZ.resize(count);
+        fillField(PERLIN, axis, period, params.seed, density);
+        fillField(PERLIN, axis, period, hash(params.seed, 1, 0, 0), potentialY);
+        fillField(PERLIN, axis, period, hash(params.seed, 2, 0, 0), potentialZ);
+    }
+    else {
+        fillField(params.basis, axis, period, params.seed, density);
+    }
+
+    const unsigned int workers = sliceWorkers(dim);
+    Util::parallelFor(workers, [&](unsigned int t) {
+        std::vector<float> rows(dim * 9);
+        float *d[9];
+        for (int i = 0; i < 9; i++) {
+            d[i] = &rows[i * dim];
+        }
+        for (int z = t; z < dim; z += workers) {
+            for (int y = 0; y < dim; y++) {
+                const size_t row = (y + z * dim) * (size_t) dim;
+                rowGradient(density, axis, y, z, d[0], d[1], d[2]);
+                if (params.basis == CURL) {
+                    rowGradient(potentialY, axis, y, z, d[3], d[4], d[5]);
+                    rowGradient(potentialZ, axis, y, z, d[6], d[7], d[8]);
+                    /* (dPz/dy - dPy/dz, dPx/dz - dPz/dx, dPy/dx - dPx/dy) */
+                    for (int x = 0; x < dim; x++) {
+                        float cx = d[7][x] - d[5][x];
+                        float cy = d[2][x] - d[6][x];
+                        float cz = d[3][x] - d[1][x];
+                        d[0][x] = cx;
+                        d[1][x] = cy;
+                        d[2][x] = cz;
+                    }
+                }
+                packRow(d[0], d[1], d[2], &density[row], dim, &texels[row]);
+            }
+        }
+    });
+}
+
+/* Reference generator */
+static int getIndex(int x, int y, int z, int dim) {
+    if (x < 0)
+        x += dim;
+    if (y < 0)
+        y += dim;
+    if (z < 0)
+        z += dim;
+
+    x = x % dim;
+    y = y % dim;
+    z = z % dim;
+
+    return x + y * dim + z * dim * dim;
+}
+
+static float getDensity(int index, const NoiseGenerator::Texel *pTexels) {
+    return (float)pTexels[index].a / 128.0f;
+}
+
+static void setNormal(glm::vec3 normal, int index, NoiseGenerator::Texel *pTexels) {
+    pTexels[index].r = (char)(normal.r * 128.0f);
+    pTexels[index].g = (char)(normal.g * 128.0f);
+    pTexels[index].b = (char)(normal.b * 128.0f);
+}
+
+void NoiseGenerator::generateReference(int dimension, std::vector<Texel> &texels) {
+    texels.resize(dimension*dimension*dimension);
+    Texel *pData = texels.data();
+
+    /* Populate data */
+    for (int i = 0; i < dimension*dimension*dimension; i++) {
+        pData[i].a = (char) Util::genRandom(-128.f, 128.f);
+    }
+
+    // Generate normals from the density gradient
+    float heightAdjust = 0.5f;
+    glm::vec3 normal;
+    glm::vec3 densityGradient;
+    for (int z = 0; z < dimension; z++) {
+        for (int y = 0; y < dimension; y++) {
+            for (int x = 0; x < dimension; x++) {
+                densityGradient.x = getDensity(getIndex(x + 1, y, z, dimension), pData) - getDensity(getIndex(x - 1, y, z, dimension), pData) / heightAdjust;
+                densityGradient.y = getDensity(getIndex(x, y + 1, z, dimension), pData) - getDensity(getIndex(x, y - 1, z, dimension), pData) / heightAdjust;
+                densityGradient.z = getDensity(getIndex(x, y, z + 1, dimension), pData) - getDensity(getIndex(x, y, z - 1, dimension), pData) / heightAdjust;
+                normal = glm::normalize(densityGradient);
+                setNormal(normal, getIndex(x, y, z, dimension), pData);
+            }
+        }
+    }
+}
\ No newline at end of file
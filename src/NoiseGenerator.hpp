@@ -0,0 +1,51 @@
+/* Noise generator
+ * Builds tileable noise volumes on the CPU in the layout the cone tracer samples -
+ * a density per texel with the normal of its gradient
+ * Every random value is a hash of its lattice coordinates and a seed so z slices
+ * are filled on worker threads in any order with identical results
+ * Rows are filled from small per-row tables by SSE2 kernels four texels wide,
+ * with scalar loops for the tail and for targets without SSE2 */
+#pragma once
+#ifndef _NOISE_GENERATOR_HPP_
+#define _NOISE_GENERATOR_HPP_
+
+#include <vector>
+#include <cstdint>
+
+class NoiseGenerator {
+    public:
+        /* Bumped whenever the same parameters would generate different texels */
+        static const uint32_t VERSION = 1;
+
+        enum Basis { WHITE, VALUE, PERLIN, WORLEY, CURL };
+
+        struct Params {
+            Basis basis = WHITE;
+            int dimension = 32;
+            int period = 8;         // Lattice cells across the volume, white noise uses one per texel
+            uint32_t seed = 0;
+        };
+
+        /* RGBA8 snorm texel - normal in rgb, density in a
+         * Curl noise stores the curl of a Perlin potential in rgb instead */
+        struct Texel { int8_t r, g, b, a; };
+
+        /* Fill a dimension^3 volume */
+        static void generate(const Params &, std::vector<Texel> &);
+
+        /* Original single threaded rand() generator, kept to benchmark against */
+        static void generateReference(int, std::vector<Texel> &);
+
+        /* Counter-based hash of a lattice point */
+        static inline uint32_t hash(uint32_t x, uint32_t y, uint32_t z, uint32_t seed) {
+            uint32_t h = seed ^ (x * 0x8da6b343u) ^ (y * 0xd8163841u) ^ (z * 0xcb1ab31fu);
+            h ^= h >> 16;
+            h *= 0x7feb352du;
+            h ^= h >> 15;
+            h *= 0x846ca68bu;
+            h ^= h >> 16;
+            return h;
+        }
+};
+
+#endif
\ No newline at end of file
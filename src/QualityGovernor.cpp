@@ -0,0 +1,89 @@
+#include "QualityGovernor.hpp"
+
+#include "CloudVolume.hpp"
+#include "Shaders/ConeTraceShader.hpp"
+#include "Shaders/GLSL.hpp"
+
+#include "glm/glm.hpp"
+
+const QualityGovernor::Level QualityGovernor::LEVELS[NUM_LEVELS] = {
+    {  16,  6,  4 },
+    {  32, 10,  6 },
+    {  32, 16,  8 },
+    {  64, 20, 10 },
+    { 128, 24, 12 },
+    { 256, 30, 15 }
+};
+
+QualityGovernor::QualityGovernor() {
+    CHECK_GL_CALL(glGenQueries(QUERY_RING_SIZE, queries));
+}
+
+QualityGovernor::~QualityGovernor() {
+    CHECK_GL_CALL(glDeleteQueries(QUERY_RING_SIZE, queries));
+}
+
+/* Skip timing the frame if every query is still in flight */
+void QualityGovernor::beginFrame() {
+    timing = queryCount < QUERY_RING_SIZE;
+    if (!timing) {
+        return;
+    }
+    CHECK_GL_CALL(glBeginQuery(GL_TIME_ELAPSED, queries[(queryHead + queryCount) % QUERY_RING_SIZE]));
+}
+
+void QualityGovernor::endFrame() {
+    if (!timing) {
+        return;
+    }
+    CHECK_GL_CALL(glEndQuery(GL_TIME_ELAPSED));
+    queryCount++;
+    timing = false;
+}
+
+void QualityGovernor::update(CloudVolume *volume, ConeTraceShader *coneShader) {
+    /* Drain finished queries in order */
+    while (queryCount) {
+        GLuint query = queries[queryHead];
+        GLint available = 0;
+        CHECK_GL_CALL(glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available));
+        if (!available) {
+            break;
+        }
+        GLuint64 ns = 0;
+        CHECK_GL_CALL(glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns));
+        float ms = ns / 1000000.f;
+        gpuMs = gpuMs > 0.f ? glm::mix(gpuMs, ms, 0.1f) : ms;
+        queryHead = (queryHead + 1) % QUERY_RING_SIZE;
+        queryCount--;
+        if (cooldown) {
+            cooldown--;
+        }
+    }
+
+    if (!enabled || cooldown || gpuMs <= 0.f) {
+        return;
+    }
+
+    /* Hysteresis between the two thresholds keeps the ladder from oscillating */
+    int next = level;
+    if (gpuMs > targetMs && level > 0) {
+        next--;
+    }
+    else if (gpuMs < targetMs * headroom && level < NUM_LEVELS - 1) {
+        next++;
+    }
+    if (next != level) {
+        level = next;
+        applyLevel(volume, coneShader);
+        cooldown = cooldownFrames;
+        gpuMs = 0.f;
+    }
+}
+
+void QualityGovernor::applyLevel(CloudVolume *volume, ConeTraceShader *coneShader) const {
+    const Level &settings = LEVELS[level];
+    volume->setDimension(settings.dimension);
+    coneShader->vctSteps = settings.vctSteps;
+    coneShader->maxNoiseSteps = settings.maxNoiseSteps;
+}
\ No newline at end of file
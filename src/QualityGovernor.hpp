@@ -0,0 +1,52 @@
+/* Quality governor
+ * Steps volume resolution and march lengths up or down a fixed ladder
+ * to hold a target GPU frame time measured with timer queries */
+#pragma once
+#ifndef _QUALITY_GOVERNOR_HPP_
+#define _QUALITY_GOVERNOR_HPP_
+
+#include <glad/glad.h>
+
+class CloudVolume;
+class ConeTraceShader;
+class QualityGovernor {
+    public:
+        QualityGovernor();
+        ~QualityGovernor();
+
+        /* Bracket the GPU work of a frame */
+        void beginFrame();
+        void endFrame();
+
+        /* Pick up finished timings and move along the ladder if needed */
+        void update(CloudVolume *, ConeTraceShader *);
+
+        /* One rung of quality, cheapest first */
+        struct Level {
+            int dimension;
+            int vctSteps;
+            int maxNoiseSteps;
+        };
+        static const int NUM_LEVELS = 6;
+        static const Level LEVELS[NUM_LEVELS];
+
+        bool enabled = false;
+        float targetMs = 8.f;
+        float headroom = 0.75f;     // Step up only below this fraction of the target
+        int cooldownFrames = 30;    // Frames to settle after a change before judging again
+        int level = 2;
+        float gpuMs = 0.f;          // Smoothed GPU frame time
+
+        void applyLevel(CloudVolume *, ConeTraceShader *) const;
+
+    private:
+        /* Ring of timer queries so results are read a few frames late without stalling */
+        static const int QUERY_RING_SIZE = 4;
+        GLuint queries[QUERY_RING_SIZE];
+        int queryHead = 0;          // Oldest in-flight query
+        int queryCount = 0;
+        bool timing = false;
+        int cooldown = 0;
+};
+
+#endif
\ No newline at end of file
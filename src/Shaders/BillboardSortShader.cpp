@@ -0,0 +1,69 @@
+#include "BillboardSortShader.hpp"
+
+BillboardSortShader::BillboardSortShader(const std::string &r, const std::string &k, const std::string &s) {
+    /* Initialize shaders */
+    keyShader = new ComputeShader(r, k);  // depth key generation
+    sortShader = new ComputeShader(r, s); // bitonic sort passes
+
+    CHECK_GL_CALL(glGenBuffers(1, &keySSBO));
+    CHECK_GL_CALL(glGenBuffers(1, &orderSSBO));
+    resizeBuffers(BLOCK_SIZE);
+}
+
+void BillboardSortShader::sort(CloudVolume *volume, const glm::vec3 &point) {
+    int count = volume->billboards.count;
+    if (!count) {
+        return;
+    }
+
+    /* Pad to a power of two no smaller than one block */
+    int sortCount = BLOCK_SIZE;
+    while (sortCount < count) {
+        sortCount <<= 1;
+    }
+    if (sortCount > capacity) {
+        resizeBuffers(sortCount);
+    }
+
+    CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, KEY_BINDING, keySSBO));
+    CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ORDER_BINDING, orderSSBO));
+    volume->bindBillboardBuffer(BOARD_BINDING);
+
+    /* Generate keys */
+    keyShader->bind();
+    keyShader->loadBool(keyShader->getUniform("halfInstances"), volume->halfFloatInstances);
+    keyShader->loadInt(keyShader->getUniform("boardCount"), count);
+    keyShader->loadInt(keyShader->getUniform("sortCount"), sortCount);
+    keyShader->loadVector(keyShader->getUniform("sortPoint"), point - volume->position);
+    keyShader->dispatch(sortCount);
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+    keyShader->unbind();
+
+    /* Bitonic sort - passes wider than a block compare in global memory,
+     * the rest of each stage runs in shared memory */
+    sortShader->bind();
+    for (int stage = 2; stage <= sortCount; stage <<= 1) {
+        int passSize = stage >> 1;
+        sortShader->loadInt(sortShader->getUniform("stage"), stage);
+        sortShader->loadBool(sortShader->getUniform("localPasses"), false);
+        for (; passSize > BLOCK_SIZE / 2; passSize >>= 1) {
+            sortShader->loadInt(sortShader->getUniform("passSize"), passSize);
+            sortShader->dispatch(sortCount / 2);
+            CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+        }
+        sortShader->loadInt(sortShader->getUniform("passSize"), passSize);
+        sortShader->loadBool(sortShader->getUniform("localPasses"), true);
+        sortShader->dispatch(sortCount / 2);
+        CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+    }
+    sortShader->unbind();
+}
+
+void BillboardSortShader::resizeBuffers(int size) {
+    capacity = size;
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, keySSBO));
+    CHECK_GL_CALL(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * capacity, nullptr, GL_DYNAMIC_COPY));
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, orderSSBO));
+    CHECK_GL_CALL(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * capacity, nullptr, GL_DYNAMIC_COPY));
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
@@ -0,0 +1,39 @@
+/* GPU billboard sort
+ * Computes per-billboard depth keys and bitonic sorts an order buffer
+ * without reading anything back to the CPU */
+#pragma once
+#ifndef _BILLBOARD_SORT_SHADER_HPP_
+#define _BILLBOARD_SORT_SHADER_HPP_
+
+#include "ComputeShader.hpp"
+#include "CloudVolume.hpp"
+
+class BillboardSortShader {
+    public:
+        BillboardSortShader(const std::string &, const std::string &, const std::string &);
+
+        ComputeShader * keyShader;
+        ComputeShader * sortShader;
+
+        /* Sort billboards back to front relative to a point
+         * Sorted billboard indices are left in orderSSBO */
+        void sort(CloudVolume *, const glm::vec3 &);
+
+        /* SSBO binding points shared with billboard_vert_instanced.glsl */
+        static const GLuint KEY_BINDING = 0;
+        static const GLuint ORDER_BINDING = 1;
+        static const GLuint BOARD_BINDING = 2;
+
+        GLuint keySSBO;
+        GLuint orderSSBO;
+
+    private:
+        /* Elements handled per work group by the shared memory passes */
+        static const int BLOCK_SIZE = 512;
+
+        /* Sort buffers are sized to a power of two */
+        int capacity = 0;
+        void resizeBuffers(int);
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "ClipmapShader.hpp"
+
+#include "BillboardSortShader.hpp"
+#include "Util.hpp"
+
+#include "Sun.hpp"
+
+ClipmapShader::ClipmapShader(const std::string &r, const std::string &c, MipShader *mips) :
+    mipShader(mips) {
+    clipmapVoxelizer = new ComputeShader(r, c);
+}
+
+void ClipmapShader::update(CloudVolume *volume, const glm::vec3 &center) {
+    Clipmap &clipmap = volume->clipmap;
+    clipmap.updatedVoxels = 0;
+    if (clipmap.dimension != volume->dimension || clipmap.levels != volume->levels) {
+        clipmap.resize(volume->dimension, volume->levels);
+    }
+
+    /* Finest cascade matches the volume's voxels */
+    clipmap.baseVoxelSize = glm::min(volume->voxelSize.x, glm::min(volume->voxelSize.y, volume->voxelSize.z));
+    uint64_t hash = inputHash(volume);
+    if (hash != clipmap.inputHash) {
+        clipmap.invalidate();
+        clipmap.inputHash = hash;
+    }
+
+    const int dim = clipmap.dimension;
+    for (int c = 0; c < clipmap.cascades; c++) {
+        /* Snap to whole voxels so resident voxels keep their world position */
+        glm::ivec3 origin = glm::ivec3(glm::floor(center / clipmap.voxelSize(c))) - dim / 2;
+        glm::ivec3 delta = origin - clipmap.origins[c];
+        glm::ivec3 absDelta = glm::abs(delta);
+        if (!clipmap.valid[c] || absDelta.x >= dim || absDelta.y >= dim || absDelta.z >= dim) {
+            updateRegion(volume, c, origin, origin + dim);
+        }
+        /* Rewrite the slab entered along each axis, the rest stays put toroidally */
+        else {
+            for (int axis = 0; axis < 3; axis++) {
+                if (!delta[axis]) {
+                    continue;
+                }
+                glm::ivec3 slabMin = origin;
+                glm::ivec3 slabMax = origin + dim;
+                if (delta[axis] > 0) {
+                    slabMin[axis] = clipmap.origins[c][axis] + dim;
+                }
+                else {
+                    slabMax[axis] = clipmap.origins[c][axis];
+                }
+                updateRegion(volume, c, slabMin, slabMax);
+            }
+        }
+        clipmap.origins[c] = origin;
+        clipmap.valid[c] = true;
+    }
+}
+
+uint64_t ClipmapShader::inputHash(const CloudVolume *volume) const {
+    uint64_t hash = Util::HASH_SEED;
+    Util::hash(hash, Sun::position);
+    Util::hash(hash, volume->position);
+    Util::hash(hash, volume->fluffiness);
+    Util::hash(hash, volume->halfFloatInstances);
+    Util::hash(hash, volume->billboards.generation);
+    Util::hash(hash, volume->clipmap.baseVoxelSize);
+    Util::hash(hash, mipShader->reduction);
+    return hash;
+}
+
+/* Voxels test every billboard sphere directly, so a region is independent of
+ * the rest of the cascade and can be rewritten on its own */
+void ClipmapShader::updateRegion(CloudVolume *volume, int cascade, const glm::ivec3 &min, const glm::ivec3 &max) {
+    Clipmap &clipmap = volume->clipmap;
+    const int dim = clipmap.dimension;
+    glm::ivec3 size = max - min;
+    clipmap.updatedVoxels += size.x * size.y * size.z;
+
+    clipmapVoxelizer->bind();
+    volume->bindBillboardBuffer(BillboardSortShader::BOARD_BINDING);
+    CHECK_GL_CALL(glBindImageTexture(0, clipmap.textures[cascade], 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R8));
+    clipmapVoxelizer->loadInt(clipmapVoxelizer->getUniform("voxelDim"), dim);
+    clipmapVoxelizer->loadFloat(clipmapVoxelizer->getUniform("voxelSize"), clipmap.voxelSize(cascade));
+    clipmapVoxelizer->loadVector(clipmapVoxelizer->getUniform("regionMin"), min);
+    clipmapVoxelizer->loadVector(clipmapVoxelizer->getUniform("regionSize"), size);
+    clipmapVoxelizer->loadBool(clipmapVoxelizer->getUniform("halfInstances"), volume->halfFloatInstances);
+    clipmapVoxelizer->loadInt(clipmapVoxelizer->getUniform("boardCount"), volume->billboards.count);
+    clipmapVoxelizer->loadVector(clipmapVoxelizer->getUniform("volumePosition"), volume->position);
+    clipmapVoxelizer->loadFloat(clipmapVoxelizer->getUniform("fluffiness"), volume->fluffiness);
+    clipmapVoxelizer->loadVector(clipmapVoxelizer->getUniform("lightDir"), glm::normalize(Sun::position - volume->position));
+    clipmapVoxelizer->dispatch(size.x, size.y, size.z);
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+    CHECK_GL_CALL(glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R8));
+    clipmapVoxelizer->unbind();
+
+    /* Region wraps around the texture edges, re-mip each unwrapped piece */
+    for (int piece = 0; piece < 8; piece++) {
+        glm::ivec3 pieceMin, pieceMax;
+        bool empty = false;
+        for (int axis = 0; axis < 3; axis++) {
+            bool wrapped = (piece >> axis) & 1;
+            int start = ((min[axis] % dim) + dim) % dim;
+            int end = start + size[axis];
+            pieceMin[axis] = wrapped ? 0 : start;
+            pieceMax[axis] = wrapped ? end - dim : glm::min(end, dim);
+            empty = empty || pieceMax[axis] <= pieceMin[axis];
+        }
+        if (!empty) {
+            mipShader->build(clipmap.textures[cascade], clipmap.levels, pieceMin, pieceMax);
+        }
+    }
+}
\ No newline at end of file
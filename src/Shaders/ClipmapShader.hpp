@@ -0,0 +1,30 @@
+/* Clipmap shader
+ * Keeps a volume's clipmap cascades centred on a point, rewriting only
+ * the slabs each cascade scrolls into */
+#pragma once
+#ifndef _CLIPMAP_SHADER_HPP_
+#define _CLIPMAP_SHADER_HPP_
+
+#include "ComputeShader.hpp"
+#include "MipShader.hpp"
+#include "CloudVolume.hpp"
+
+class ClipmapShader {
+    public:
+        ClipmapShader(const std::string &, const std::string &, MipShader *);
+
+        ComputeShader * clipmapVoxelizer;
+        MipShader * mipShader;
+
+        /* Recentre every cascade on a world position */
+        void update(CloudVolume *, const glm::vec3 &);
+
+    private:
+        /* Hash of everything but the centre the cascades depend on */
+        uint64_t inputHash(const CloudVolume *) const;
+
+        /* Voxelize and re-mip a world voxel region [min, max) of a cascade */
+        void updateRegion(CloudVolume *, int, const glm::ivec3 &, const glm::ivec3 &);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,38 @@
+#include "ComputeShader.hpp"
+
+#include "ProgramCache.hpp"
+
+ComputeShader::ComputeShader(const std::string &res, const std::string &cName) {
+    pid = glCreateProgram();
+
+    /* Skip compiling entirely if the driver accepts a cached binary of this source */
+    const uint64_t key = ProgramCache::key({ stageSource(res, cName, "") });
+    if (!ProgramCache::load(pid, key)) {
+        if (cName.size() && (cShaderId = compileShader(GL_COMPUTE_SHADER, res, cName))) {
+            CHECK_GL_CALL(glAttachShader(pid, cShaderId));
+        }
+        CHECK_GL_CALL(glProgramParameteri(pid, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+        CHECK_GL_CALL(glLinkProgram(pid));
+
+        // See whether link was successful
+        GLint linkSuccess;
+        CHECK_GL_CALL(glGetProgramiv(pid, GL_LINK_STATUS, &linkSuccess));
+        if (!linkSuccess) {
+            GLSL::printProgramInfoLog(pid);
+            std::cout << "Error linking compute shader " << cName << std::endl;
+            std::cin.get();
+            exit(EXIT_FAILURE);
+        }
+        ProgramCache::store(pid, key);
+    }
+
+    CHECK_GL_CALL(glGetProgramiv(pid, GL_COMPUTE_WORK_GROUP_SIZE, glm::value_ptr(localSize)));
+    findAttributesAndUniforms(res, cName);
+}
+
+void ComputeShader::dispatch(const int x, const int y, const int z) const {
+    CHECK_GL_CALL(glDispatchCompute(
+        (x + localSize.x - 1) / localSize.x,
+        (y + localSize.y - 1) / localSize.y,
+        (z + localSize.z - 1) / localSize.z));
+}
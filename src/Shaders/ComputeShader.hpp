@@ -0,0 +1,23 @@
+/* Compute shader
+ * Single-stage program with a dispatch helper */
+#pragma once
+#ifndef _COMPUTE_SHADER_HPP_
+#define _COMPUTE_SHADER_HPP_
+
+#include "Shader.hpp"
+
+class ComputeShader : public Shader {
+    public:
+        ComputeShader(const std::string &, const std::string &);
+
+        /* Dispatch enough work groups to cover a number of invocations */
+        void dispatch(const int, const int = 1, const int = 1) const;
+
+        /* Work group size read back from the linked program */
+        glm::ivec3 localSize;
+
+    private:
+        GLint cShaderId = 0;
+};
+
+#endif
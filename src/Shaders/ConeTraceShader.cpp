@@ -5,11 +5,53 @@
 #include "Library.hpp"
 #include "Util.hpp"
 
-ConeTraceShader::ConeTraceShader(const std::string &r, const std::string &v, const std::string &f) :
+#include <chrono>
+#include <cstring>
+
+ConeTraceShader::ConeTraceShader(const std::string &r, const std::string &v, const std::string &f, const std::string &k, const std::string &s, const std::string &c, const std::string &uv, const std::string &uf, const std::string &t, const std::string &n) :
     Shader(r, v, f) {
 
+    /* Create GPU billboard sorter */
+    boardSorter = new BillboardSortShader(r, k, s);
+
+    /* Create per-billboard lighting cache builder */
+    cacheBuilder = new ComputeShader(r, c);
+    CHECK_GL_CALL(glGenBuffers(1, &cacheSSBO));
+
+    /* Create reduced resolution target and its upsampler */
+    upsampler = new UpsampleShader(r, uv, uf);
+    CHECK_GL_CALL(glGenFramebuffers(1, &cloudFBO));
+
+    /* Create temporal accumulation resolver */
+    temporalResolver = new ComputeShader(r, t);
+
+    /* Create octave baker */
+    noiseBaker = new ComputeShader(r, n);
+    const std::string bakeSource = stageSource(r, n, "");
+    bakeSourceHash = Util::HASH_SEED;
+    Util::hashBytes(bakeSourceHash, bakeSource.data(), bakeSource.size());
+
     /* Create noise map */
-    initNoiseMap(32);
+    CHECK_GL_CALL(glGenTextures(1, &noiseMapId));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, noiseMapId));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    updateNoiseMap();
+}
+
+/* Radical inverse of an index in a base */
+static float halton(int index, int base) {
+    float result = 0.f;
+    float fraction = 1.f;
+    while (index > 0) {
+        fraction /= base;
+        result += fraction * (index % base);
+        index /= base;
+    }
+    return result;
 }
 
 void ConeTraceShader::coneTrace(CloudVolume *volume) {
@@ -17,15 +59,60 @@ void ConeTraceShader::coneTrace(CloudVolume *volume) {
         return;
     }
 
-    volume->sortBoards(Camera::getPosition());
+    /* Sort billboards back to front */
+    if (gpuSort) {
+        boardSorter->sort(volume, Camera::getPosition());
+    }
+    else {
+        volume->sortBoards(Camera::getPosition());
+    }
+
+    /* Regenerate the base noise and rebake octaves if their parameters moved */
+    if (doNoiseSample) {
+        updateNoiseMap();
+        if (bakeNoise) {
+            updateBakedNoise();
+        }
+    }
+
+    /* Refresh cached lighting before drawing reads it */
+    bool cached = useLightingCache(volume);
+    if (cached) {
+        updateLightingCache(volume);
+    }
+
+    /* Temporal accumulation also goes through the offscreen target */
+    if (!temporal) {
+        historyValid = false;
+    }
+    bool offscreen = resolutionScale > 1 || temporal;
+    if (offscreen) {
+        beginReducedPass();
+    }
 
     CHECK_GL_CALL(glDisable(GL_DEPTH_TEST));
+    setDefines(specialize ? variantDefines() : "");
     bind();
     bindVolume(volume);
+    loadBool(getUniform("cachedLight"), cached);
+    if (cached) {
+        CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CACHE_BINDING, cacheSSBO));
+        volume->bindBillboardIds(CloudVolume::BOARD_ID_BINDING);
+    }
+
+    /* Read billboards through the GPU sorted order */
+    loadBool(getUniform("gpuSorted"), gpuSort);
+    if (gpuSort) {
+        CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BillboardSortShader::ORDER_BINDING, boardSorter->orderSSBO));
+        volume->bindBillboardBuffer(BillboardSortShader::BOARD_BINDING);
+    }
 
     loadVector(getUniform("lightPos"), Sun::position);
     loadBool(getUniform("showQuad"), showQuad);
+
     loadVector(getUniform("volumePosition"), volume->position);
+    loadFloat(getUniform("fluffiness"), volume->fluffiness);
+    loadBool(getUniform("halfInstances"), volume->halfFloatInstances);
 
     /* Bind cone tracing params */
     loadBool(getUniform("doConeTrace"), doConeTrace);
@@ -60,8 +147,30 @@ void ConeTraceShader::coneTrace(CloudVolume *volume) {
     }
     loadVector(getUniform("octaveOffsets"), octaveOffsets.data()[0]);
 
+    /* Baked octaves scroll together */
+    loadBool(getUniform("bakedNoise"), bakeNoise);
+    if (bakeNoise) {
+        CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + bakedNoiseId));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, bakedNoiseId));
+        loadInt(getUniform("bakedNoiseMap"), bakedNoiseId);
+        loadFloat(getUniform("bakedAmplitude"), bakedAmplitude);
+        loadVector(getUniform("noiseScroll"), windVel * (float) Window::runTime);
+    }
+
+    /* Temporal frames shift the projection by a sub-pixel Halton(2, 3) offset */
+    glm::mat4 P = Camera::getP();
+    temporalJitter = glm::vec2(0.f);
+    if (temporal) {
+        int sample = temporalFrame % 8 + 1;
+        temporalJitter = glm::vec2(halton(sample, 2), halton(sample, 3)) - 0.5f;
+        glm::mat4 jitterT(1.f);
+        jitterT[3][0] = 2.f * temporalJitter.x / cloudWidth;
+        jitterT[3][1] = 2.f * temporalJitter.y / cloudHeight;
+        P = jitterT * P;
+    }
+
     /* Bind P V Vi*/
-    loadMatrix(getUniform("P"), &Camera::getP());
+    loadMatrix(getUniform("P"), &P);
     loadMatrix(getUniform("V"), &Camera::getV());
     glm::mat4 Vi = Camera::getV();
     Vi[3][0] = Vi[3][1] = Vi[3][2] = 0.f;
@@ -79,17 +188,285 @@ void ConeTraceShader::coneTrace(CloudVolume *volume) {
     unbindVolume();
     unbind();
     CHECK_GL_CALL(glEnable(GL_DEPTH_TEST));
+
+    if (offscreen) {
+        endReducedPass();
+    }
+}
+
+/* Smallest power of two holding a loop count */
+static int loopBucket(int count) {
+    int bucket = 1;
+    while (bucket < count) {
+        bucket <<= 1;
+    }
+    return bucket;
+}
+
+/* Counts only split variants when their loop is actually compiled in */
+std::string ConeTraceShader::variantDefines() const {
+    const bool noise = !showQuad && doNoiseSample;
+    const bool coneTrace = !showQuad && doConeTrace;
+    const int octaves = noise && !bakeNoise ? loopBucket(numOctaves) : 1;
+    const int steps = coneTrace ? loopBucket(vctSteps) : 1;
+
+    std::string defines;
+    defines += "#define SHOW_QUAD " + std::to_string((int) showQuad) + "\n";
+    defines += "#define DO_NOISE " + std::to_string((int) noise) + "\n";
+    defines += "#define DO_CONE_TRACE " + std::to_string((int) coneTrace) + "\n";
+    defines += "#define BAKED_NOISE " + std::to_string((int) (noise && bakeNoise)) + "\n";
+    defines += "#define MAX_OCTAVES " + std::to_string(octaves) + "\n";
+    defines += "#define MAX_VCT_STEPS " + std::to_string(steps) + "\n";
+    return defines;
+}
+
+/* Redirect cloud drawing into the reduced target
+ * Color accumulates premultiplied so it can be composited later, depth keeps the nearest cloud
+ * Temporal frames shade a quarter of the composited pixels and history fills in the rest */
+void ConeTraceShader::beginReducedPass() {
+    int width = glm::max(1, Window::width / resolutionScale);
+    int height = glm::max(1, Window::height / resolutionScale);
+    int shadedWidth = temporal ? glm::max(1, width / 2) : width;
+    int shadedHeight = temporal ? glm::max(1, height / 2) : height;
+    if (shadedWidth != cloudWidth || shadedHeight != cloudHeight || width != historyWidth || height != historyHeight) {
+        resizeCloudTargets(shadedWidth, shadedHeight, width, height);
+    }
+
+    CHECK_GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, cloudFBO));
+    CHECK_GL_CALL(glViewport(0, 0, cloudWidth, cloudHeight));
+    const GLfloat clearColor[] = { 0.f, 0.f, 0.f, 0.f };
+    const GLfloat clearDepth[] = { 1e30f, 0.f, 0.f, 0.f };
+    CHECK_GL_CALL(glClearBufferfv(GL_COLOR, 0, clearColor));
+    CHECK_GL_CALL(glClearBufferfv(GL_COLOR, 1, clearDepth));
+    CHECK_GL_CALL(glBlendFuncSeparatei(0, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+    CHECK_GL_CALL(glBlendEquationi(1, GL_MIN));
+}
+
+void ConeTraceShader::endReducedPass() {
+    CHECK_GL_CALL(glBlendEquationi(1, GL_FUNC_ADD));
+    CHECK_GL_CALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+    CHECK_GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    CHECK_GL_CALL(glViewport(0, 0, Window::width, Window::height));
+    if (temporal) {
+        resolveTemporal();
+        upsampler->composite(historyColor[historyIndex], historyDepth[historyIndex]);
+    }
+    else {
+        upsampler->composite(cloudColor, cloudDepth);
+    }
+}
+
+static void createTarget(GLuint &texture, GLenum format, int width, int height) {
+    if (texture) {
+        CHECK_GL_CALL(glDeleteTextures(1, &texture));
+    }
+    CHECK_GL_CALL(glGenTextures(1, &texture));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, texture));
+    CHECK_GL_CALL(glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, format == GL_R32F ? GL_NEAREST : GL_LINEAR));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, format == GL_R32F ? GL_NEAREST : GL_LINEAR));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+}
+
+/* (Re)create the cloud target and both history buffers, history starts over */
+void ConeTraceShader::resizeCloudTargets(int width, int height, int fullWidth, int fullHeight) {
+    cloudWidth = width;
+    cloudHeight = height;
+    historyWidth = fullWidth;
+    historyHeight = fullHeight;
+    createTarget(cloudColor, GL_RGBA16F, width, height);
+    createTarget(cloudDepth, GL_R32F, width, height);
+    for (int i = 0; i < 2; i++) {
+        createTarget(historyColor[i], GL_RGBA16F, fullWidth, fullHeight);
+        createTarget(historyDepth[i], GL_R32F, fullWidth, fullHeight);
+    }
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+    historyValid = false;
+
+    CHECK_GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, cloudFBO));
+    CHECK_GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, cloudColor, 0));
+    CHECK_GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, cloudDepth, 0));
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    CHECK_GL_CALL(glDrawBuffers(2, drawBuffers));
+}
+
+/* Blend this frame's jittered clouds into reprojected history, written to the next history buffer */
+void ConeTraceShader::resolveTemporal() {
+    int previous = historyIndex;
+    historyIndex = 1 - historyIndex;
+
+    temporalResolver->bind();
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + cloudColor));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, cloudColor));
+    temporalResolver->loadInt(temporalResolver->getUniform("currentColor"), cloudColor);
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + cloudDepth));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, cloudDepth));
+    temporalResolver->loadInt(temporalResolver->getUniform("currentDepth"), cloudDepth);
+    CHECK_GL_CALL(glBindImageTexture(0, historyColor[historyIndex], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F));
+    CHECK_GL_CALL(glBindImageTexture(1, historyDepth[historyIndex], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F));
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + historyColor[previous]));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, historyColor[previous]));
+    temporalResolver->loadInt(temporalResolver->getUniform("historyColor"), historyColor[previous]);
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + historyDepth[previous]));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, historyDepth[previous]));
+    temporalResolver->loadInt(temporalResolver->getUniform("historyDepth"), historyDepth[previous]);
+    temporalResolver->loadBool(temporalResolver->getUniform("historyValid"), historyValid);
+
+    /* Current view to rebuild positions, last frame's to reproject them */
+    glm::mat4 PV = Camera::getP() * Camera::getV();
+    glm::mat4 Vi = glm::inverse(Camera::getV());
+    glm::vec2 projScale(Camera::getP()[0][0], Camera::getP()[1][1]);
+    temporalResolver->loadVector(temporalResolver->getUniform("currentSize"), glm::ivec2(cloudWidth, cloudHeight));
+    temporalResolver->loadVector(temporalResolver->getUniform("targetSize"), glm::ivec2(historyWidth, historyHeight));
+    temporalResolver->loadVector(temporalResolver->getUniform("jitter"), temporalJitter);
+    temporalResolver->loadMatrix(temporalResolver->getUniform("Vi"), &Vi);
+    temporalResolver->loadVector(temporalResolver->getUniform("projScale"), projScale);
+    temporalResolver->loadMatrix(temporalResolver->getUniform("prevPV"), &prevPV);
+    temporalResolver->loadFloat(temporalResolver->getUniform("depthTolerance"), depthTolerance);
+    temporalResolver->loadFloat(temporalResolver->getUniform("historyWeight"), historyWeight);
+    temporalResolver->dispatch(historyWidth, historyHeight);
+    CHECK_GL_CALL(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+
+    /* Wrap up */
+    for (GLuint unit = 0; unit < 2; unit++) {
+        CHECK_GL_CALL(glBindImageTexture(unit, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F));
+    }
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0));
+    temporalResolver->unbind();
+
+    prevPV = PV;
+    historyValid = true;
+    temporalFrame++;
 }
 
 void ConeTraceShader::bindVolume(CloudVolume *volume) {
-    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + volume->volId));
-    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, volume->volId));
-    loadInt(getUniform("volumeTexture"), volume->volId);
+    /* Sparse volumes have no dense texture, the atlas stands in for it */
+    GLuint texture = volume->sparse ? volume->bricks.atlasId : volume->volId;
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + texture));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, texture));
+    loadInt(getUniform("volumeTexture"), texture);
 
     loadVector(getUniform("xBounds"), volume->position.x + volume->xBounds);
     loadVector(getUniform("yBounds"), volume->position.y + volume->yBounds);
     loadVector(getUniform("zBounds"), volume->position.z + volume->zBounds);
     loadInt(getUniform("voxelDim"), volume->dimension);
+
+    /* Sparse voxel octree */
+    loadBool(getUniform("octree"), volume->octree.enabled);
+    loadInt(getUniform("octreeDepth"), volume->octree.depth);
+    if (volume->octree.enabled) {
+        CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SparseOctree::NODE_BINDING, volume->octree.nodeBuffer));
+    }
+
+    /* Camera-centred clipmap, unused cascades alias the coarsest */
+    const Clipmap &clipmap = volume->clipmap;
+    loadBool(getUniform("clipmap"), clipmap.enabled);
+    if (clipmap.enabled) {
+        loadInt(getUniform("clipCascades"), clipmap.cascades);
+        loadFloat(getUniform("clipVoxelSize"), clipmap.baseVoxelSize);
+        loadVector(getUniform("clipCenter"), Camera::getPosition());
+        for (int i = 0; i < Clipmap::MAX_CASCADES; i++) {
+            GLuint texture = clipmap.textures[glm::min(i, clipmap.cascades - 1)];
+            CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + texture));
+            CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, texture));
+            loadInt(getUniform("clipmap" + std::to_string(i)), texture);
+        }
+    }
+
+    /* Precomputed transmittance, built from the dense volume only */
+    const LightVolume &light = volume->light;
+    bool precomputed = light.enabled && !volume->sparse && light.textureId;
+    loadBool(getUniform("precomputedLight"), precomputed);
+    if (precomputed) {
+        CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + light.textureId));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, light.textureId));
+        loadInt(getUniform("transmittance"), light.textureId);
+        loadMatrix(getUniform("transmittancePV"), &light.lightPV);
+    }
+
+    /* Sparse volume */
+    loadBool(getUniform("brickMap"), volume->sparse);
+    if (volume->sparse) {
+        const BrickMap &bricks = volume->bricks;
+        CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + bricks.indirectionId));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, bricks.indirectionId));
+        loadInt(getUniform("brickIndirection"), bricks.indirectionId);
+        CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + bricks.atlasId));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, bricks.atlasId));
+        loadInt(getUniform("brickAtlas"), bricks.atlasId);
+        loadInt(getUniform("atlasBricks"), bricks.atlasBricks);
+        loadInt(getUniform("atlasLevels"), bricks.levels);
+    }
+}
+
+/* Cache only covers the plain cone trace over the dense volume */
+bool ConeTraceShader::useLightingCache(const CloudVolume *volume) const {
+    return cacheLighting && doConeTrace && volume->billboards.count
+        && !volume->sparse && !volume->octree.enabled && !volume->clipmap.enabled
+        && !volume->light.enabled;
+}
+
+uint64_t ConeTraceShader::cacheHash(const CloudVolume *volume) const {
+    uint64_t hash = Util::HASH_SEED;
+    Util::hash(hash, volume->voxelGeneration);
+    Util::hash(hash, Sun::position);
+    Util::hash(hash, vctSteps);
+    Util::hash(hash, vctConeAngle);
+    Util::hash(hash, vctConeInitialHeight);
+    Util::hash(hash, vctLodOffset);
+    Util::hash(hash, vctDownScaling);
+    return hash;
+}
+
+/* Rebuild when the voxels or the cone and light parameters changed
+ * Entries are keyed by billboard id, so sorting never invalidates them
+ * Billboard edits, position and fluffiness already re-run voxelization */
+void ConeTraceShader::updateLightingCache(CloudVolume *volume) {
+    uint64_t hash = cacheHash(volume);
+    if (hash == builtCacheHash && cacheCapacity >= volume->billboards.count) {
+        return;
+    }
+    builtCacheHash = hash;
+    cacheBuilds++;
+
+    if (volume->billboards.count > cacheCapacity) {
+        cacheCapacity = glm::max(volume->billboards.count, 2 * cacheCapacity);
+        CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, cacheSSBO));
+        CHECK_GL_CALL(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * CACHE_POINTS * cacheCapacity, nullptr, GL_DYNAMIC_COPY));
+        CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+    }
+
+    cacheBuilder->bind();
+    volume->bindBillboardBuffer(BillboardSortShader::BOARD_BINDING);
+    volume->bindBillboardIds(CloudVolume::BOARD_ID_BINDING);
+    CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CACHE_BINDING, cacheSSBO));
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + volume->volId));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, volume->volId));
+    cacheBuilder->loadInt(cacheBuilder->getUniform("volumeTexture"), volume->volId);
+    cacheBuilder->loadVector(cacheBuilder->getUniform("xBounds"), volume->position.x + volume->xBounds);
+    cacheBuilder->loadVector(cacheBuilder->getUniform("yBounds"), volume->position.y + volume->yBounds);
+    cacheBuilder->loadVector(cacheBuilder->getUniform("zBounds"), volume->position.z + volume->zBounds);
+    cacheBuilder->loadInt(cacheBuilder->getUniform("voxelDim"), volume->dimension);
+    cacheBuilder->loadBool(cacheBuilder->getUniform("halfInstances"), volume->halfFloatInstances);
+    cacheBuilder->loadVector(cacheBuilder->getUniform("volumePosition"), volume->position);
+    cacheBuilder->loadFloat(cacheBuilder->getUniform("fluffiness"), volume->fluffiness);
+    cacheBuilder->loadVector(cacheBuilder->getUniform("lightPos"), Sun::position);
+    cacheBuilder->loadInt(cacheBuilder->getUniform("vctSteps"), vctSteps);
+    cacheBuilder->loadFloat(cacheBuilder->getUniform("vctConeAngle"), vctConeAngle);
+    cacheBuilder->loadFloat(cacheBuilder->getUniform("vctConeInitialHeight"), vctConeInitialHeight);
+    cacheBuilder->loadFloat(cacheBuilder->getUniform("vctLodOffset"), vctLodOffset);
+    cacheBuilder->loadFloat(cacheBuilder->getUniform("vctDownScaling"), vctDownScaling);
+
+    /* One work group per billboard */
+    cacheBuilder->dispatch(volume->billboards.count * cacheBuilder->localSize.x, cacheBuilder->localSize.y);
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+
+    /* Wrap up */
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0));
+    cacheBuilder->unbind();
 }
 
 void ConeTraceShader::unbindVolume() {
@@ -97,63 +474,168 @@ void ConeTraceShader::unbindVolume() {
     CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
 }
 
-int getIndex(int x, int y, int z, int dim) {
-    if (x < 0)
-        x += dim;
-    if (y < 0)
-        y += dim;
-    if (z < 0)
-        z += dim;
+void ConeTraceShader::updateBakedNoise() {
+    uint64_t hash = Util::HASH_SEED;
+    Util::hash(hash, noiseMapHash);
+    Util::hash(hash, bakeSourceHash);
+    Util::hash(hash, bakedNoiseSize);
+    Util::hash(hash, numOctaves);
+    Util::hash(hash, freqStep);
+    Util::hash(hash, persStep);
+    if (bakedNoiseId && hash == bakedNoiseHash) {
+        storeBakedNoise();
+        return;
+    }
+    bakedNoiseHash = hash;
+    noiseBakes++;
+
+    /* Any readback still in flight is for parameters that just moved */
+    if (bakeReadbackFence) {
+        CHECK_GL_CALL(glDeleteSync(bakeReadbackFence));
+        bakeReadbackFence = 0;
+    }
+    pendingBakeKey = 0;
 
-    x = x % dim;
-    y = y % dim;
-    z = z % dim;
+    /* Immutable so recreated on resize */
+    if (allocatedNoiseSize != bakedNoiseSize) {
+        if (bakedNoiseId) {
+            CHECK_GL_CALL(glDeleteTextures(1, &bakedNoiseId));
+        }
+        allocatedNoiseSize = bakedNoiseSize;
+        CHECK_GL_CALL(glGenTextures(1, &bakedNoiseId));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, bakedNoiseId));
+        CHECK_GL_CALL(glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA8_SNORM, bakedNoiseSize, bakedNoiseSize, bakedNoiseSize));
+        CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT));
+        CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT));
+        CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT));
+        CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+        CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    }
 
-    return x + y * dim + z * dim * dim;
-}
+    /* Total amplitude keeps the normalized sum inside snorm range */
+    bakedAmplitude = 0.f;
+    float pers = 1.f;
+    for (int i = 0; i < numOctaves; i++) {
+        bakedAmplitude += glm::abs(pers);
+        pers *= persStep;
+    }
+    bakedAmplitude = glm::max(bakedAmplitude, 1e-4f);
 
-struct CHAR4 { char r, g, b, a; };
+    /* A previous run may have baked these exact octaves already */
+    VolumeCache::Mapping mapping;
+    if (volumeCache.load(hash, GL_RGBA8_SNORM, bakedNoiseSize, bakedNoiseSize, bakedNoiseSize, 4, mapping)) {
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, bakedNoiseId));
+        CHECK_GL_CALL(glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, bakedNoiseSize, bakedNoiseSize, bakedNoiseSize, GL_RGBA, GL_BYTE, mapping.data));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+        return;
+    }
 
-float getDensity(int index, CHAR4* pTexels) {
-    return (float)pTexels[index].a / 128.0f;
-}
+    noiseBaker->bind();
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + noiseMapId));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, noiseMapId));
+    noiseBaker->loadInt(noiseBaker->getUniform("noiseMap"), noiseMapId);
+    CHECK_GL_CALL(glBindImageTexture(0, bakedNoiseId, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8_SNORM));
+    noiseBaker->loadInt(noiseBaker->getUniform("bakedSize"), bakedNoiseSize);
+    noiseBaker->loadInt(noiseBaker->getUniform("numOctaves"), numOctaves);
+    noiseBaker->loadFloat(noiseBaker->getUniform("freqStep"), freqStep);
+    noiseBaker->loadFloat(noiseBaker->getUniform("persStep"), persStep);
+    noiseBaker->loadFloat(noiseBaker->getUniform("amplitude"), bakedAmplitude);
+    noiseBaker->dispatch(bakedNoiseSize, bakedNoiseSize, bakedNoiseSize);
+    CHECK_GL_CALL(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT));
 
-void setNormal(glm::vec3 normal, int index, CHAR4* pTexels) {
-    pTexels[index].r = (char)(normal.r * 128.0f);
-    pTexels[index].g = (char)(normal.g * 128.0f);
-    pTexels[index].b = (char)(normal.b * 128.0f);
+    /* Wrap up */
+    CHECK_GL_CALL(glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8_SNORM));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0));
+    noiseBaker->unbind();
+
+    /* Saved once the parameters settle */
+    pendingBakeKey = hash;
+    bakeStableFrames = 0;
 }
 
-void ConeTraceShader::initNoiseMap(int dimension) {
-    CHAR4* pData = new CHAR4[dimension*dimension*dimension];
+/* Once a bake has gone unchanged for a while copy it into a PBO, and once the fence
+ * says the copy landed hand the texels to a writer thread - the render thread never waits */
+void ConeTraceShader::storeBakedNoise() {
+    if (!pendingBakeKey || !volumeCache.enabled) {
+        return;
+    }
+    const GLsizeiptr bytes = (GLsizeiptr) bakedNoiseSize * bakedNoiseSize * bakedNoiseSize * 4;
+
+    if (!bakeReadbackFence) {
+        if (++bakeStableFrames < CACHE_STORE_DELAY) {
+            return;
+        }
+        if (!bakeReadbackPBO) {
+            CHECK_GL_CALL(glGenBuffers(1, &bakeReadbackPBO));
+        }
+        CHECK_GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, bakeReadbackPBO));
+        CHECK_GL_CALL(glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ));
+        CHECK_GL_CALL(glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, bakedNoiseId));
+        CHECK_GL_CALL(glGetTexImage(GL_TEXTURE_3D, 0, GL_RGBA, GL_BYTE, nullptr));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+        CHECK_GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+        bakeReadbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        return;
+    }
+
+    GLenum status = glClientWaitSync(bakeReadbackFence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+        return;
+    }
+    CHECK_GL_CALL(glDeleteSync(bakeReadbackFence));
+    bakeReadbackFence = 0;
 
-    /* Populate data */
-    for (int i = 0; i < dimension*dimension*dimension; i++) {
-        pData[i].a = Util::genRandom(-128.f, 128.f);
+    std::vector<GLbyte> baked(bytes);
+    CHECK_GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, bakeReadbackPBO));
+    const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    if (mapped) {
+        std::memcpy(baked.data(), mapped, bytes);
+        CHECK_GL_CALL(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+        volumeCache.storeAsync(pendingBakeKey, GL_RGBA8_SNORM, bakedNoiseSize, bakedNoiseSize, bakedNoiseSize, 4, std::move(baked));
     }
+    CHECK_GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+    pendingBakeKey = 0;
+}
 
-    // Generate normals from the density gradient
-    float heightAdjust = 0.5f;
-    glm::vec3 normal;
-    glm::vec3 densityGradient;
-    for (int z = 0; z < dimension; z++) {
-        for (int y = 0; y < dimension; y++) {
-            for (int x = 0; x < dimension; x++) {
-                densityGradient.x = getDensity(getIndex(x + 1, y, z, dimension), pData) - getDensity(getIndex(x - 1, y, z, dimension), pData) / heightAdjust;
-                densityGradient.y = getDensity(getIndex(x, y + 1, z, dimension), pData) - getDensity(getIndex(x, y - 1, z, dimension), pData) / heightAdjust;
-                densityGradient.z = getDensity(getIndex(x, y, z + 1, dimension), pData) - getDensity(getIndex(x, y, z - 1, dimension), pData) / heightAdjust;
-                normal = glm::normalize(densityGradient);
-                setNormal(normal, getIndex(x, y, z, dimension), pData);
-            }
+void ConeTraceShader::updateNoiseMap() {
+    uint64_t hash = Util::HASH_SEED;
+    Util::hash(hash, NoiseGenerator::VERSION);
+    Util::hash(hash, noiseParams.basis);
+    Util::hash(hash, noiseParams.dimension);
+    Util::hash(hash, noiseParams.period);
+    Util::hash(hash, noiseParams.seed);
+    if (hash == noiseMapHash) {
+        /* Saved by a writer thread once the parameters settle */
+        if (pendingNoise.size() && ++noiseStableFrames >= CACHE_STORE_DELAY) {
+            const int dim = noiseParams.dimension;
+            volumeCache.storeAsync(hash, GL_RGBA8_SNORM, dim, dim, dim, sizeof(NoiseGenerator::Texel), std::move(pendingNoise));
+            pendingNoise.clear();
         }
+        return;
     }
+    noiseMapHash = hash;
+    pendingNoise.clear();
 
-    CHECK_GL_CALL(glGenTextures(1, &noiseMapId));
+    const int dim = noiseParams.dimension;
+    auto start = std::chrono::high_resolution_clock::now();
     CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, noiseMapId));
-    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT));
-    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT));
-    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT));
-    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-    CHECK_GL_CALL(glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8_SNORM, dimension, dimension, dimension, 0, GL_RGBA, GL_BYTE, pData));
-}
+    VolumeCache::Mapping mapping;
+    noiseFromCache = volumeCache.load(hash, GL_RGBA8_SNORM, dim, dim, dim, sizeof(NoiseGenerator::Texel), mapping);
+    if (noiseFromCache) {
+        CHECK_GL_CALL(glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8_SNORM, dim, dim, dim, 0, GL_RGBA, GL_BYTE, nullptr));
+        CHECK_GL_CALL(glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, dim, dim, dim, GL_RGBA, GL_BYTE, mapping.data));
+    }
+    else {
+        NoiseGenerator::generate(noiseParams, pendingNoise);
+        CHECK_GL_CALL(glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8_SNORM, dim, dim, dim, 0, GL_RGBA, GL_BYTE, pendingNoise.data()));
+        noiseStableFrames = 0;
+        if (!volumeCache.enabled) {
+            pendingNoise.clear();
+        }
+    }
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    noiseGenerateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
\ No newline at end of file
@@ -3,11 +3,16 @@
 #define _CONE_TRACE_SHADER_HPP_
 
 #include "Shader.hpp"
+#include "BillboardSortShader.hpp"
+#include "ComputeShader.hpp"
+#include "UpsampleShader.hpp"
 #include "CloudVolume.hpp"
+#include "NoiseGenerator.hpp"
+#include "VolumeCache.hpp"
 
 class ConeTraceShader : public Shader {
     public:
-        ConeTraceShader(const std::string &r, const std::string &v, const std::string &f);
+        ConeTraceShader(const std::string &r, const std::string &v, const std::string &f, const std::string &k, const std::string &s, const std::string &c, const std::string &uv, const std::string &uf, const std::string &t, const std::string &n);
 
         void coneTrace(CloudVolume *);
 
@@ -24,6 +29,23 @@ class ConeTraceShader : public Shader {
         float noiseColorScale = 0.45f;
         glm::vec3 windVel = glm::vec3(0.01f, 0, 0);
 
+        /* Base noise generated on the CPU, regenerated when its parameters change */
+        NoiseGenerator::Params noiseParams;
+        double noiseGenerateMs = 0.0;
+        bool noiseFromCache = false;
+
+        /* Generated and baked noise are written to disk and mapped back on later runs
+         * Writes wait until the parameters have held for a number of frames */
+        static const int CACHE_STORE_DELAY = 30;
+        VolumeCache volumeCache;
+
+        /* Sum every octave once into a tileable volume so the march takes one fetch per step
+         * Rebaked only when the octave parameters change, octave frequencies round to whole numbers */
+        bool bakeNoise = false;
+        int bakedNoiseSize = 128;
+        int noiseBakes = 0;
+        ComputeShader * noiseBaker;
+
         /* Cone trace parameters */
         int vctSteps = 16;
         float vctConeAngle = 0.9f;
@@ -35,12 +57,85 @@ class ConeTraceShader : public Shader {
         bool doConeTrace = true;
         bool doNoiseSample = true;
 
+        /* Draw with a program specialized for the flags above and power of two
+         * buckets of the octave and step counts instead of branching on uniforms */
+        bool specialize = true;
+
+        /* Sort billboards with compute passes instead of on the CPU */
+        bool gpuSort = false;
+        BillboardSortShader * boardSorter;
+
+        /* Draw clouds into a target 1/resolutionScale the window size and
+         * upsample it over the framebuffer with depth-aware weights */
+        int resolutionScale = 1;
+        UpsampleShader * upsampler;
+
+        /* Shade a half by half target with a sub-pixel jittered projection each frame
+         * and accumulate it into full size history reprojected with last frame's camera
+         * History is clamped to the new frame's neighborhood and rejected on disocclusion */
+        bool temporal = false;
+        float historyWeight = 0.9f;
+        float depthTolerance = 0.05f;
+        ComputeShader * temporalResolver;
+
+        /* Cone trace a fixed grid of points on each billboard sphere into an SSBO
+         * and interpolate it per fragment, rebuilt only when the voxels, light,
+         * or billboard order change - dense volumes only */
+        static const GLuint CACHE_BINDING = 6;
+        static const int CACHE_POINTS = 16;
+        bool cacheLighting = false;
+        int cacheBuilds = 0;
+        ComputeShader * cacheBuilder;
+
     private:
+        std::string variantDefines() const;
+
         void bindVolume(CloudVolume *);
         void unbindVolume();
 
-        void initNoiseMap(int);
-        GLuint noiseMapId;
+        void beginReducedPass();
+        void endReducedPass();
+        GLuint cloudFBO = 0;
+        GLuint cloudColor = 0;          // RGBA16F premultiplied
+        GLuint cloudDepth = 0;          // R32F nearest view depth
+        int cloudWidth = 0;
+        int cloudHeight = 0;
+        void resizeCloudTargets(int, int, int, int);
+
+        void resolveTemporal();
+        GLuint historyColor[2] = { 0, 0 };
+        GLuint historyDepth[2] = { 0, 0 };
+        int historyWidth = 0;
+        int historyHeight = 0;
+        int historyIndex = 0;               // History written by the last resolve
+        bool historyValid = false;
+        glm::mat4 prevPV;
+        glm::vec2 temporalJitter = glm::vec2(0.f);  // In cloud target pixels
+        unsigned int temporalFrame = 0;
+
+        bool useLightingCache(const CloudVolume *) const;
+        void updateLightingCache(CloudVolume *);
+        uint64_t cacheHash(const CloudVolume *) const;
+        GLuint cacheSSBO = 0;
+        int cacheCapacity = 0;
+        uint64_t builtCacheHash = 0;
+
+        void updateNoiseMap();
+        GLuint noiseMapId = 0;
+        uint64_t noiseMapHash = 0;
+        std::vector<NoiseGenerator::Texel> pendingNoise;   // Generated but not yet stored
+        int noiseStableFrames = 0;
+        void updateBakedNoise();
+        GLuint bakedNoiseId = 0;
+        int allocatedNoiseSize = 0;
+        float bakedAmplitude = 1.f;
+        uint64_t bakedNoiseHash = 0;
+        uint64_t bakeSourceHash = 0;    // Preprocessed bake shader, so edits miss the disk cache
+        void storeBakedNoise();
+        uint64_t pendingBakeKey = 0;    // Baked but not yet stored
+        int bakeStableFrames = 0;
+        GLuint bakeReadbackPBO = 0;
+        GLsync bakeReadbackFence = 0;
         float totalTime = 0.f;
 };
 
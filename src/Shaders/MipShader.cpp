@@ -0,0 +1,34 @@
+#include "MipShader.hpp"
+
+MipShader::MipShader(const std::string &r, const std::string &m) {
+    mipBuilder = new ComputeShader(r, m);
+}
+
+void MipShader::build(GLuint texture, int levels, const glm::ivec3 &min, const glm::ivec3 &max) {
+    glm::ivec3 regionMin = min;
+    glm::ivec3 regionMax = max;
+
+    mipBuilder->bind();
+    mipBuilder->loadInt(mipBuilder->getUniform("reduction"), reduction);
+    for (int level = 1; level < levels; level++) {
+        /* Parent region rounds outward so partially covered parents are rebuilt */
+        regionMin = regionMin / 2;
+        regionMax = (regionMax + 1) / 2;
+        glm::ivec3 size = regionMax - regionMin;
+        if (size.x <= 0 || size.y <= 0 || size.z <= 0) {
+            break;
+        }
+
+        CHECK_GL_CALL(glBindImageTexture(0, texture, level - 1, GL_TRUE, 0, GL_READ_ONLY, GL_R8));
+        CHECK_GL_CALL(glBindImageTexture(1, texture, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_R8));
+        mipBuilder->loadVector(mipBuilder->getUniform("regionMin"), regionMin);
+        mipBuilder->loadVector(mipBuilder->getUniform("regionMax"), regionMax);
+        mipBuilder->dispatch(size.x, size.y, size.z);
+        CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+    }
+    CHECK_GL_CALL(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT));
+
+    CHECK_GL_CALL(glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R8));
+    CHECK_GL_CALL(glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R8));
+    mipBuilder->unbind();
+}
@@ -0,0 +1,28 @@
+/* Mip shader
+ * Builds the volume's mip pyramid in compute passes over a voxel region */
+#pragma once
+#ifndef _MIP_SHADER_HPP_
+#define _MIP_SHADER_HPP_
+
+#include "ComputeShader.hpp"
+#include "CloudVolume.hpp"
+
+class MipShader {
+    public:
+        MipShader(const std::string &, const std::string &);
+
+        ComputeShader * mipBuilder;
+
+        /* How 2x2x2 children reduce into their parent */
+        enum Reduction {
+            AVERAGE = 0,
+            MAX = 1,
+            OPACITY = 2     // Average alpha corrected for the doubled path length
+        };
+        int reduction = AVERAGE;
+
+        /* Rebuild every mip level of an R8 3D texture over a level 0 voxel region [min, max) */
+        void build(GLuint, int, const glm::ivec3 &, const glm::ivec3 &);
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "OctreeShader.hpp"
+
+/* Header offsets of the indirect dispatch arguments */
+static const GLintptr FRAG_ARGS_OFFSET = 0;
+static const GLintptr NODE_ARGS_OFFSET = sizeof(GLuint) * 3;
+
+OctreeShader::OctreeShader(const std::string &r, const std::string &o) {
+    octreeBuilder = new ComputeShader(r, o);
+}
+
+/* Top-down subdivision from the voxel fragment list, then bottom-up filtering */
+void OctreeShader::build(CloudVolume *volume, int reduction) {
+    SparseOctree &octree = volume->octree;
+    octree.depth = 0;
+    while ((1 << octree.depth) < volume->dimension) {
+        octree.depth++;
+    }
+    octree.depth = glm::min(octree.depth, SparseOctree::MAX_LEVELS);
+
+    /* Reset counters and the root */
+    GLuint header[8 + SparseOctree::MAX_LEVELS + 2] = { 1, 1, 1, 1, 1, 1, 0, 1, 0, 1 };
+    GLuint root[2] = { 0, 0 };
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, octree.headerBuffer));
+    CHECK_GL_CALL(glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), header));
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, octree.nodeBuffer));
+    CHECK_GL_CALL(glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(root), root));
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+    octreeBuilder->bind();
+    CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SparseOctree::NODE_BINDING, octree.nodeBuffer));
+    CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SparseOctree::FRAGMENT_BINDING, octree.fragmentBuffer));
+    CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SparseOctree::HEADER_BINDING, octree.headerBuffer));
+    CHECK_GL_CALL(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, octree.headerBuffer));
+
+    /* Read voxels from the dense volume or the brick atlas */
+    GLuint texture = volume->sparse ? volume->bricks.atlasId : volume->volId;
+    CHECK_GL_CALL(glBindImageTexture(0, texture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R8));
+    octreeBuilder->loadBool(octreeBuilder->getUniform("brickMap"), volume->sparse);
+    octreeBuilder->loadInt(octreeBuilder->getUniform("atlasBricks"), volume->bricks.atlasBricks);
+    if (volume->sparse) {
+        CHECK_GL_CALL(glBindImageTexture(2, volume->bricks.indirectionId, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI));
+    }
+    octreeBuilder->loadInt(octreeBuilder->getUniform("voxelDim"), volume->dimension);
+    octreeBuilder->loadInt(octreeBuilder->getUniform("depth"), octree.depth);
+    octreeBuilder->loadInt(octreeBuilder->getUniform("reduction"), reduction);
+    CHECK_GL_CALL(glUniform1ui(octreeBuilder->getUniform("fragCapacity"), octree.fragmentCapacity));
+    CHECK_GL_CALL(glUniform1ui(octreeBuilder->getUniform("nodeCapacity"), octree.nodeCapacity));
+
+    /* Voxel fragment list */
+    octreeBuilder->loadInt(octreeBuilder->getUniform("pass"), FRAGMENTS);
+    octreeBuilder->dispatch(volume->dimension * volume->dimension, volume->dimension * octreeBuilder->localSize.y);
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+
+    /* Subdivide one level at a time */
+    for (int level = 0; level < octree.depth; level++) {
+        runPass(RANGE, level);
+        runIndirectPass(FLAG, level, FRAG_ARGS_OFFSET);
+        runIndirectPass(ALLOC, level, NODE_ARGS_OFFSET);
+    }
+    runPass(RANGE, octree.depth);
+    runIndirectPass(LEAF, octree.depth, FRAG_ARGS_OFFSET);
+
+    /* Filter interior nodes from the bottom up */
+    for (int level = octree.depth - 1; level >= 0; level--) {
+        runPass(LEVEL_ARGS, level);
+        runIndirectPass(FILTER, level, NODE_ARGS_OFFSET);
+    }
+
+    /* Wrap up */
+    CHECK_GL_CALL(glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R8));
+    CHECK_GL_CALL(glBindImageTexture(2, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI));
+    CHECK_GL_CALL(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0));
+    octreeBuilder->unbind();
+    octree.queueCountReadback();
+}
+
+/* Single work group bookkeeping pass */
+void OctreeShader::runPass(Pass pass, int level) {
+    octreeBuilder->loadInt(octreeBuilder->getUniform("pass"), pass);
+    octreeBuilder->loadInt(octreeBuilder->getUniform("level"), level);
+    CHECK_GL_CALL(glDispatchCompute(1, 1, 1));
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT));
+}
+
+/* Pass sized on the GPU by a previous bookkeeping pass */
+void OctreeShader::runIndirectPass(Pass pass, int level, GLintptr args) {
+    octreeBuilder->loadInt(octreeBuilder->getUniform("pass"), pass);
+    octreeBuilder->loadInt(octreeBuilder->getUniform("level"), level);
+    CHECK_GL_CALL(glDispatchComputeIndirect(args));
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+}
\ No newline at end of file
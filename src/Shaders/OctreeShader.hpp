@@ -0,0 +1,34 @@
+/* Octree shader
+ * Builds a sparse voxel octree from the voxelized volume in compute passes */
+#pragma once
+#ifndef _OCTREE_SHADER_HPP_
+#define _OCTREE_SHADER_HPP_
+
+#include "ComputeShader.hpp"
+#include "CloudVolume.hpp"
+
+class OctreeShader {
+    public:
+        OctreeShader(const std::string &, const std::string &);
+
+        ComputeShader * octreeBuilder;
+
+        /* Rebuild the volume's octree, interior nodes reduce like MipShader */
+        void build(CloudVolume *, int);
+
+    private:
+        /* Build passes, match octree_build_comp.glsl */
+        enum Pass {
+            FRAGMENTS = 0,
+            RANGE = 1,
+            FLAG = 2,
+            ALLOC = 3,
+            LEAF = 4,
+            LEVEL_ARGS = 5,
+            FILTER = 6
+        };
+        void runPass(Pass, int);
+        void runIndirectPass(Pass, int, GLintptr);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "ProgramCache.hpp"
+
+#include "GLSL.hpp"
+#include "Util.hpp"
+#include "VolumeCache.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+static const char MAGIC[4] = { 'C', 'P', 'R', 'G' };
+
+/* Drivers may expose no binary formats at all */
+bool ProgramCache::supported() {
+    static GLint formats = -1;
+    if (formats < 0) {
+        CHECK_GL_CALL(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats));
+    }
+    return formats > 0;
+}
+
+std::string ProgramCache::path(uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.prog", (unsigned long long) key);
+    return directory + name;
+}
+
+uint64_t ProgramCache::key(const std::vector<std::string> &sources) {
+    uint64_t hash = Util::HASH_SEED;
+    Util::hash(hash, VERSION);
+    const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (GLenum name : driverStrings) {
+        const char *string = (const char *) glGetString(name);
+        if (string) {
+            Util::hashBytes(hash, string, strlen(string));
+        }
+    }
+    for (const std::string &source : sources) {
+        Util::hash(hash, source.size());
+        Util::hashBytes(hash, source.data(), source.size());
+    }
+    return hash;
+}
+
+bool ProgramCache::load(GLuint pid, uint64_t key) {
+    if (!enabled || !supported()) {
+        return false;
+    }
+
+    FILE *fp = fopen(path(key).c_str(), "rb");
+    if (!fp) {
+        misses++;
+        return false;
+    }
+    Header header;
+    std::vector<char> binary;
+    bool read = fread(&header, sizeof(header), 1, fp) == 1 &&
+                !memcmp(header.magic, MAGIC, sizeof(MAGIC)) &&
+                header.version == VERSION &&
+                header.key == key &&
+                header.length > 0;
+    if (read) {
+        binary.resize(header.length);
+        read = fread(binary.data(), header.length, 1, fp) == 1;
+    }
+    fclose(fp);
+    if (!read) {
+        misses++;
+        return false;
+    }
+
+    CHECK_GL_CALL(glProgramBinary(pid, header.format, binary.data(), header.length));
+    GLint linkSuccess;
+    CHECK_GL_CALL(glGetProgramiv(pid, GL_LINK_STATUS, &linkSuccess));
+    if (!linkSuccess) {
+        misses++;
+        return false;
+    }
+    hits++;
+    return true;
+}
+
+/* Written under a temporary name and renamed so a crash never leaves a partial file */
+void ProgramCache::store(GLuint pid, uint64_t key) {
+    if (!enabled || !supported()) {
+        return;
+    }
+
+    GLint length = 0;
+    CHECK_GL_CALL(glGetProgramiv(pid, GL_PROGRAM_BINARY_LENGTH, &length));
+    if (length <= 0) {
+        return;
+    }
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    CHECK_GL_CALL(glGetProgramBinary(pid, length, &length, &format, binary.data()));
+
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.key = key;
+    header.format = format;
+    header.length = (uint32_t) length;
+
+    VolumeCache::makeDirectory(directory);
+    const std::string finalPath = path(key);
+    const std::string tmpPath = finalPath + ".tmp";
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if (!fp) {
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                   fwrite(binary.data(), header.length, 1, fp) == 1;
+    written = fclose(fp) == 0 && written;
+    if (written) {
+        remove(finalPath.c_str());
+        written = rename(tmpPath.c_str(), finalPath.c_str()) == 0;
+    }
+    if (!written) {
+        remove(tmpPath.c_str());
+    }
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+/* Program cache
+ * Linked programs saved with glGetProgramBinary and restored with glProgramBinary
+ * Keyed by the preprocessed stage sources and the driver that built them, so
+ * editing a shader or updating the driver falls back to compiling from source */
+#pragma once
+#ifndef _PROGRAM_CACHE_HPP_
+#define _PROGRAM_CACHE_HPP_
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class ProgramCache {
+    public:
+        /* Bumped whenever the file layout changes */
+        static const uint32_t VERSION = 1;
+
+        static bool enabled;
+        static std::string directory;
+        static int hits;
+        static int misses;
+
+        /* Hash of every stage's source and the driver strings */
+        static uint64_t key(const std::vector<std::string> &);
+
+        /* Link a program from the binary stored under a key
+         * Misses if there is no file or the driver rejects the binary */
+        static bool load(GLuint, uint64_t);
+
+        /* Save a linked program's binary under a key */
+        static void store(GLuint, uint64_t);
+
+    private:
+        struct Header {
+            char magic[4];          // "CPRG"
+            uint32_t version;
+            uint64_t key;
+            uint32_t format;        // Driver specific binary format
+            uint32_t length;
+        };
+
+        static bool supported();
+        static std::string path(uint64_t);
+};
+
+#endif
\ No newline at end of file
@@ -1,57 +1,160 @@
 #include "Shader.hpp"
 
+#include "ProgramCache.hpp"
+
+#include <algorithm>
 #include <fstream>
-#include <vector>
+#include <sstream>
 
 Shader::Shader(const std::string &res, const std::string &v, const std::string &f) :
     Shader(res, v, f, "")
 { }
 
-Shader::Shader(const std::string &res, const std::string &vName, const std::string &fName, const std::string &gName) {
+Shader::Shader(const std::string &res, const std::string &vName, const std::string &fName, const std::string &gName) :
+    resDir(res),
+    vertName(vName),
+    fragName(fName),
+    geomName(gName) {
+    buildProgram();
+}
+
+void Shader::buildProgram() {
 	pid = glCreateProgram();
-    if (vName.size() && (vShaderId = compileShader(GL_VERTEX_SHADER, res, vName))) {
+
+    /* Skip compiling entirely if the driver accepts a cached binary of these sources */
+    const uint64_t key = ProgramCache::key({ stageSource(resDir, vertName, defines), stageSource(resDir, fragName, defines), stageSource(resDir, geomName, defines) });
+    bool cached = ProgramCache::load(pid, key);
+    if (!cached && vertName.size() && (vShaderId = compileShader(GL_VERTEX_SHADER, resDir, vertName, defines))) {
 	    CHECK_GL_CALL(glAttachShader(pid, vShaderId));
     }
-    if (fName.size() && (fShaderId = compileShader(GL_FRAGMENT_SHADER, res, fName))) {
+    if (!cached && fragName.size() && (fShaderId = compileShader(GL_FRAGMENT_SHADER, resDir, fragName, defines))) {
         CHECK_GL_CALL(glAttachShader(pid, fShaderId));
     }
-    if (gName.size() && (gShaderId = compileShader(GL_GEOMETRY_SHADER, res, gName))) {
+    if (!cached && geomName.size() && (gShaderId = compileShader(GL_GEOMETRY_SHADER, resDir, geomName, defines))) {
 	    CHECK_GL_CALL(glAttachShader(pid, gShaderId));
     }
-	CHECK_GL_CALL(glLinkProgram(pid));
+    if (!cached) {
+        CHECK_GL_CALL(glProgramParameteri(pid, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+        CHECK_GL_CALL(glLinkProgram(pid));
 
-    // See whether link was successful
-    GLint linkSuccess;
-	CHECK_GL_CALL(glGetProgramiv(pid, GL_LINK_STATUS, &linkSuccess));
-	if (!linkSuccess) {
-        GLSL::printProgramInfoLog(pid);
-        std::cout << "Error linking shaders " << vName << " and " << fName;
-        if (gShaderId) {
-            std::cout << " and " << gName << std::endl;
-        }
-        else {
-            std::cout << std::endl;
+        // See whether link was successful
+        GLint linkSuccess;
+        CHECK_GL_CALL(glGetProgramiv(pid, GL_LINK_STATUS, &linkSuccess));
+        if (!linkSuccess) {
+            GLSL::printProgramInfoLog(pid);
+            std::cout << "Error linking shaders " << vertName << " and " << fragName;
+            if (gShaderId) {
+                std::cout << " and " << geomName << std::endl;
+            }
+            else {
+                std::cout << std::endl;
+            }
+            std::cin.get();
+            exit(EXIT_FAILURE);
         }
-        std::cin.get();
-        exit(EXIT_FAILURE);
-	}
+        ProgramCache::store(pid, key);
+    }
 
-    if (vShaderId) {
-        findAttributesAndUniforms(res, vName);
+    if (vertName.size()) {
+        findAttributesAndUniforms(resDir, vertName);
     }
-    if (fShaderId) {
-        findAttributesAndUniforms(res, fName);
+    if (fragName.size()) {
+        findAttributesAndUniforms(resDir, fragName);
     }
-    if (gShaderId) {
-        findAttributesAndUniforms(res, gName);
+    if (geomName.size()) {
+        findAttributesAndUniforms(resDir, geomName);
     }
 }
 
-GLuint Shader::compileShader(GLenum shaderType, const std::string &res, const std::string &shaderName) {
-    // Read the shader source file into a string
-    char *shaderString = GLSL::textFileRead((res + shaderName).c_str());
-    // Stop if there was an error reading the shader source file
-    if (shaderString == NULL) return 0;
+void Shader::setDefines(const std::string &newDefines) {
+    if (newDefines == defines) {
+        return;
+    }
+
+    /* Park the active program - map swaps are constant time */
+    Program &active = parkedPrograms[defines];
+    active.pid = pid;
+    active.vShaderId = vShaderId;
+    active.fShaderId = fShaderId;
+    active.gShaderId = gShaderId;
+    active.attributes.swap(attributes);
+    active.uniforms.swap(uniforms);
+    defines = newDefines;
+
+    auto parked = parkedPrograms.find(defines);
+    if (parked == parkedPrograms.end()) {
+        vShaderId = fShaderId = gShaderId = 0;
+        buildProgram();
+        return;
+    }
+    pid = parked->second.pid;
+    vShaderId = parked->second.vShaderId;
+    fShaderId = parked->second.fShaderId;
+    gShaderId = parked->second.gShaderId;
+    attributes.swap(parked->second.attributes);
+    uniforms.swap(parked->second.uniforms);
+    parkedPrograms.erase(parked);
+}
+
+bool Shader::preprocess(const std::string &res, const std::string &name, const std::string &defines, std::string &source, std::vector<std::string> &files) {
+    char *text = GLSL::textFileRead((res + name).c_str());
+    if (text == NULL) {
+        return false;
+    }
+    const int sourceNumber = (int) files.size();
+    files.push_back(name);
+
+    std::istringstream stream(text);
+    free(text);
+    std::string line;
+    int lineNumber = 0;
+    bool ok = true;
+    while (std::getline(stream, line)) {
+        lineNumber++;
+        size_t start = line.find_first_not_of(" \t");
+        if (start != std::string::npos && !line.compare(start, 8, "#include")) {
+            size_t open = line.find('"', start);
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            std::string include = close == std::string::npos ? "" : line.substr(open + 1, close - open - 1);
+            if (include.empty()) {
+                std::cout << "Malformed include in " << res << name << ":" << lineNumber << std::endl;
+                ok = false;
+                continue;
+            }
+            if (std::find(files.begin(), files.end(), include) == files.end()) {
+                source += "#line 1 " + std::to_string(files.size()) + "\n";
+                ok &= preprocess(res, include, "", source, files);
+                source += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(sourceNumber) + "\n";
+            }
+            continue;
+        }
+
+        source += line + "\n";
+        if (start != std::string::npos && !line.compare(start, 8, "#version") && defines.size()) {
+            source += defines;
+            source += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(sourceNumber) + "\n";
+        }
+    }
+    return ok;
+}
+
+std::string Shader::stageSource(const std::string &res, const std::string &name, const std::string &stageDefines) {
+    std::string source;
+    std::vector<std::string> files;
+    if (name.size()) {
+        preprocess(res, name, stageDefines, source, files);
+    }
+    return source;
+}
+
+GLuint Shader::compileShader(GLenum shaderType, const std::string &res, const std::string &shaderName, const std::string &shaderDefines) {
+    // Expand includes and defines into one source string
+    std::string source;
+    std::vector<std::string> files;
+    if (!preprocess(res, shaderName, shaderDefines, source, files)) {
+        return 0;
+    }
+    const char *shaderString = source.c_str();
     
     // Create the shader, assign source code, and compile it
     GLuint shader = glCreateShader(shaderType);
@@ -64,18 +167,27 @@ GLuint Shader::compileShader(GLenum shaderType, const std::string &res, const st
     if (!compileSuccess) {
         GLSL::printShaderInfoLog(shader);
         std::cout << "Error compiling shader: " << res << shaderName << std::endl;
+        for (unsigned int i = 1; i < files.size(); i++) {
+            std::cout << "  source " << i << ": " << files[i] << std::endl;
+        }
+        if (shaderDefines.size()) {
+            std::cout << shaderDefines;
+        }
         std::cin.get();
         exit(EXIT_FAILURE);
     }
     
-    // Free the memory
-    free(shaderString);
-    
     return shader;
 }
 
 void Shader::findAttributesAndUniforms(const std::string &res, const std::string &shaderName) {
-    char *fileText = GLSL::textFileRead((res + shaderName).c_str());
+    // Included files declare uniforms too
+    std::string source;
+    std::vector<std::string> files;
+    preprocess(res, shaderName, "", source, files);
+    std::vector<char> text(source.begin(), source.end());
+    text.push_back('\0');
+    char *fileText = text.data();
     char *token;
     char *lastToken = nullptr;
     
@@ -112,10 +224,14 @@ void Shader::findAttributesAndUniforms(const std::string &res, const std::string
             addUniform(lineEnding + (lastDelimiter + 1));
         } 
         else if (!strcmp(token, "layout")) {
+            // Only inputs are attributes - skip images, buffers, and work group sizes
+            bool isInput = false;
+            lastToken = nullptr;
             while((token = strtok(NULL, " ")) != NULL) {
+                isInput |= !strcmp(token, "in");
                 lastToken = token;
             }
-            if (lastToken) {
+            if (isInput && lastToken && strcmp(lastToken, "in")) {
                 addAttribute(lastToken);
             }
         } 
@@ -123,9 +239,6 @@ void Shader::findAttributesAndUniforms(const std::string &res, const std::string
             continue;
         }
     }
-    
-    // Free the memory
-    free(fileText);
 }
 
 void Shader::bind() {
@@ -138,7 +251,7 @@ void Shader::unbind() {
 
 void Shader::addAttribute(const std::string &name) {
     GLint r = glGetAttribLocation(pid, name.c_str());
-    if (r < 0) {
+    if (r < 0 && defines.empty()) {
         std::cerr << "WARN: " << name << " cannot be bound (it either doesn't exist or has been optimized away). safe_glAttrib calls will silently ignore it\n" << std::endl;
     }
     attributes[name] = r;
@@ -146,7 +259,8 @@ void Shader::addAttribute(const std::string &name) {
 
 void Shader::addUniform(const std::string &name) {
     GLint r = glGetUniformLocation(pid, name.c_str());
-    if (r < 0) {
+    /* Specialized programs compile out the uniforms of disabled features */
+    if (r < 0 && defines.empty()) {
         std::cerr << "WARN: " << name << " cannot be bound (it either doesn't exist or has been optimized away). safe_glAttrib calls will silently ignore it\n" << std::endl;
     }  
     uniforms[name] = r;
@@ -172,6 +286,17 @@ GLint Shader::getUniform(const std::string &name) {
 
 void Shader::cleanUp() {
     unbind();
+    for (auto &parked : parkedPrograms) {
+        const Program &program = parked.second;
+        CHECK_GL_CALL(glDetachShader(program.pid, program.vShaderId));
+        CHECK_GL_CALL(glDetachShader(program.pid, program.fShaderId));
+        CHECK_GL_CALL(glDetachShader(program.pid, program.gShaderId));
+        CHECK_GL_CALL(glDeleteShader(program.vShaderId));
+        CHECK_GL_CALL(glDeleteShader(program.fShaderId));
+        CHECK_GL_CALL(glDeleteShader(program.gShaderId));
+        CHECK_GL_CALL(glDeleteProgram(program.pid));
+    }
+    parkedPrograms.clear();
     CHECK_GL_CALL(glDetachShader(pid, vShaderId));
     CHECK_GL_CALL(glDetachShader(pid, fShaderId));
     CHECK_GL_CALL(glDetachShader(pid, gShaderId));
@@ -205,6 +330,14 @@ void Shader::loadVector(const int location, const glm::vec4 & v) const {
     CHECK_GL_CALL(glUniform4f(location, v.r, v.g, v.b, v.a));
 }
 
+void Shader::loadVector(const int location, const glm::ivec2 & v) const { 
+    CHECK_GL_CALL(glUniform2i(location, v.x, v.y));
+}
+
+void Shader::loadVector(const int location, const glm::ivec3 & v) const { 
+    CHECK_GL_CALL(glUniform3i(location, v.x, v.y, v.z));
+}
+
 void Shader::loadMatrix(const int location, const glm::mat4 *m) const { 
     CHECK_GL_CALL(glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(*m)));
 }
@@ -12,6 +12,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include <iostream>
 
 class Shader {
@@ -26,6 +27,13 @@ class Shader {
         void addAttribute(const std::string &);
         void addUniform(const std::string &);
 
+        /* Select the program built with a block of #define lines injected after #version
+         * Each distinct block is compiled the first time it's selected and kept for later switches
+         * Vertex/fragment/geometry programs only */
+        void setDefines(const std::string &);
+        const std::string & getDefines() const { return defines; }
+        int programCount() const { return (int) parkedPrograms.size() + 1; }
+
         /* Parent load functions */
         void loadBool(const int, const bool) const;
         void loadInt(const int, const int) const;
@@ -33,6 +41,8 @@ class Shader {
         void loadVector(const int, const glm::vec2 &) const;
         void loadVector(const int, const glm::vec3 &) const;
         void loadVector(const int, const glm::vec4 &) const;
+        void loadVector(const int, const glm::ivec2 &) const;
+        void loadVector(const int, const glm::ivec3 &) const;
         void loadMatrix(const int, const glm::mat4*) const;
         void loadMatrix(const int, const glm::mat3*) const;
 
@@ -40,16 +50,41 @@ class Shader {
         GLint getAttribute(const std::string &);
         GLint getUniform(const std::string &);
 
-    private:    
+    protected:
+        Shader() {}
+
         /* GLSL shader attributes */
         GLuint pid = 0;
-        GLint vShaderId;
-        GLint fShaderId;
-        GLint gShaderId;
+        GLint vShaderId = 0;
+        GLint fShaderId = 0;
+        GLint gShaderId = 0;
         std::map<std::string, GLint> attributes;
         std::map<std::string, GLint> uniforms;
 
-        GLuint compileShader(GLenum, const std::string &, const std::string &);
+        /* Source names and defines of the active program */
+        std::string resDir, vertName, fragName, geomName;
+        std::string defines;
+
+        /* Programs built for other defines, swapped back in when selected again */
+        struct Program {
+            GLuint pid = 0;
+            GLint vShaderId = 0;
+            GLint fShaderId = 0;
+            GLint gShaderId = 0;
+            std::map<std::string, GLint> attributes;
+            std::map<std::string, GLint> uniforms;
+        };
+        std::map<std::string, Program> parkedPrograms;
+        void buildProgram();
+
+        /* Expand #include "file" lines against the resource directory and inject defines after #version
+         * Each file is included once, returns false if any file can't be read */
+        static bool preprocess(const std::string &, const std::string &, const std::string &, std::string &, std::vector<std::string> &);
+
+        /* Preprocessed source of one stage, empty for an unused stage */
+        static std::string stageSource(const std::string &, const std::string &, const std::string &);
+
+        GLuint compileShader(GLenum, const std::string &, const std::string &, const std::string & = "");
         void findAttributesAndUniforms(const std::string &, const std::string &);
 };
 
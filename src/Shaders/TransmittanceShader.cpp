@@ -0,0 +1,42 @@
+#include "TransmittanceShader.hpp"
+
+#include "Sun.hpp"
+
+TransmittanceShader::TransmittanceShader(const std::string &r, const std::string &t) {
+    transmittanceBuilder = new ComputeShader(r, t);
+}
+
+void TransmittanceShader::build(CloudVolume *volume) {
+    LightVolume &light = volume->light;
+    if (light.size != volume->dimension) {
+        light.resize(volume->dimension);
+    }
+    light.lightPV = Sun::P * Sun::V;
+    glm::mat4 lightPVi = glm::inverse(light.lightPV);
+    CHECK_GL_CALL(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT));
+
+    transmittanceBuilder->bind();
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + volume->volId));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, volume->volId));
+    transmittanceBuilder->loadInt(transmittanceBuilder->getUniform("volumeTexture"), volume->volId);
+    CHECK_GL_CALL(glBindImageTexture(1, light.textureId, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R16F));
+
+    /* Planes span the light's clip range, measured in voxels so extinction doesn't depend on scale */
+    float voxel = glm::min(volume->voxelSize.x, glm::min(volume->voxelSize.y, volume->voxelSize.z));
+    transmittanceBuilder->loadVector(transmittanceBuilder->getUniform("xBounds"), volume->position.x + volume->xBounds);
+    transmittanceBuilder->loadVector(transmittanceBuilder->getUniform("yBounds"), volume->position.y + volume->yBounds);
+    transmittanceBuilder->loadVector(transmittanceBuilder->getUniform("zBounds"), volume->position.z + volume->zBounds);
+    transmittanceBuilder->loadInt(transmittanceBuilder->getUniform("voxelDim"), volume->dimension);
+    transmittanceBuilder->loadInt(transmittanceBuilder->getUniform("transmittanceSize"), light.size);
+    transmittanceBuilder->loadMatrix(transmittanceBuilder->getUniform("lightPVi"), &lightPVi);
+    transmittanceBuilder->loadFloat(transmittanceBuilder->getUniform("sliceLength"), Sun::clipDistance / light.size / voxel);
+    transmittanceBuilder->loadFloat(transmittanceBuilder->getUniform("extinction"), light.extinction);
+    transmittanceBuilder->dispatch(light.size, light.size);
+    CHECK_GL_CALL(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT));
+
+    /* Wrap up */
+    CHECK_GL_CALL(glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R16F));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0));
+    transmittanceBuilder->unbind();
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+/* Transmittance shader
+ * Sweeps the voxelized volume along the light direction into a LightVolume */
+#pragma once
+#ifndef _TRANSMITTANCE_SHADER_HPP_
+#define _TRANSMITTANCE_SHADER_HPP_
+
+#include "ComputeShader.hpp"
+#include "CloudVolume.hpp"
+
+class TransmittanceShader {
+    public:
+        TransmittanceShader(const std::string &, const std::string &);
+
+        ComputeShader * transmittanceBuilder;
+
+        /* Rebuild the volume's light volume from its level 0 voxels and the current Sun */
+        void build(CloudVolume *);
+};
+
+#endif
\ No newline at end of file
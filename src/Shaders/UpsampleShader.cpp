@@ -0,0 +1,39 @@
+#include "UpsampleShader.hpp"
+
+#include "Library.hpp"
+
+void UpsampleShader::composite(GLuint color, GLuint depth) {
+    CHECK_GL_CALL(glDisable(GL_DEPTH_TEST));
+    CHECK_GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+    bind();
+
+    /* Bind cloud target */
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + color));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, color));
+    loadInt(getUniform("cloudColor"), color);
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + depth));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, depth));
+    loadInt(getUniform("cloudDepth"), depth);
+    loadFloat(getUniform("depthSharpness"), depthSharpness);
+
+    /* Bind empty matrices to render full screen quad */
+    glm::mat4 M = glm::mat4(1.f);
+    glm::mat3 N = glm::mat3(1.f);
+    loadMatrix(getUniform("P"), &M);
+    loadMatrix(getUniform("V"), &M);
+    loadMatrix(getUniform("Vi"), &M);
+    loadMatrix(getUniform("M"), &M);
+    loadMatrix(getUniform("N"), &N);
+
+    /* Draw full screen quad */
+    CHECK_GL_CALL(glBindVertexArray(Library::quad->vaoId));
+    CHECK_GL_CALL(glDrawArrays(GL_TRIANGLE_STRIP, 0, 4));
+
+    /* Wrap up */
+    CHECK_GL_CALL(glBindVertexArray(0));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0));
+    unbind();
+    CHECK_GL_CALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+    CHECK_GL_CALL(glEnable(GL_DEPTH_TEST));
+}
\ No newline at end of file
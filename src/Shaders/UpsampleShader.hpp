@@ -0,0 +1,22 @@
+/* Upsample shader
+ * Composites a reduced resolution cloud target over the default framebuffer,
+ * weighting texels by depth so cloud edges stay sharp */
+#pragma once
+#ifndef _UPSAMPLE_SHADER_HPP_
+#define _UPSAMPLE_SHADER_HPP_
+
+#include "Shader.hpp"
+
+class UpsampleShader : public Shader {
+    public:
+        UpsampleShader(const std::string &r, const std::string &v, const std::string &f) :
+            Shader(r, v, f)
+        {}
+
+        float depthSharpness = 4.f;
+
+        /* Blend premultiplied cloud color with its nearest view depth over the current framebuffer */
+        void composite(GLuint, GLuint);
+};
+
+#endif
\ No newline at end of file
@@ -6,47 +6,50 @@
 
 #include "glm/gtc/matrix_transform.hpp"
 
-VoxelShader::VoxelShader(int dimension, const std::string &r, const std::string &v, const std::string &f) :
+#include <cstddef>
+
+/* Matches DrawElementsIndirectCommand */
+struct DrawCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLuint baseVertex;
+    GLuint baseInstance;
+};
+
+VoxelShader::VoxelShader(int dimension, const std::string &r, const std::string &v, const std::string &f, const std::string &c) :
     Shader(r, v, f) {
-    int numVoxels = dimension * dimension * dimension;
-
-    /* Init voxel CPU vectors 
-     * Extra position for bounds */
-    this->voxelPositions.resize(numVoxels + 1);
-    this->voxelData.resize(numVoxels);
+    compactShader = new ComputeShader(r, c);
 
     /* Create instanced cube mesh */
     this->cube = Library::createCube();
 
-    /* Voxel positions vbo */
-    CHECK_GL_CALL(glBindVertexArray(cube->vaoId));
-    CHECK_GL_CALL(glGenBuffers(1, &cubePositionVBO));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, cubePositionVBO));
-    CHECK_GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * voxelPositions.size(), nullptr, GL_DYNAMIC_DRAW));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0)); 
-    CHECK_GL_CALL(glEnableVertexAttribArray(2));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, cubePositionVBO));
-    CHECK_GL_CALL(glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));	
-    CHECK_GL_CALL(glVertexAttribDivisor(2, 1)); 
-
-    /* Voxel data vbo */
-    CHECK_GL_CALL(glGenBuffers(1, &cubeDataVBO));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, cubeDataVBO));
-    CHECK_GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * voxelData.size(), nullptr, GL_DYNAMIC_DRAW));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
-    CHECK_GL_CALL(glEnableVertexAttribArray(3));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, cubeDataVBO));
-    CHECK_GL_CALL(glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0));
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));	
-    CHECK_GL_CALL(glVertexAttribDivisor(3, 1));
-
-    CHECK_GL_CALL(glBindVertexArray(0));
+    /* Voxel buffer doubles as the instance attribute source */
+    CHECK_GL_CALL(glGenBuffers(1, &voxelBuffer));
+    CHECK_GL_CALL(glGenBuffers(1, &commandBuffer));
+    CHECK_GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer));
+    CHECK_GL_CALL(glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand), nullptr, GL_DYNAMIC_DRAW));
+    CHECK_GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+    resizeBuffers(dimension * dimension * dimension);
+
+    /* Persistently mapped counter readback ring */
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    CHECK_GL_CALL(glGenBuffers(1, &readbackBuffer));
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer));
+    CHECK_GL_CALL(glBufferStorage(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * READBACK_RING_SIZE, nullptr, flags));
+    mappedReadback = (GLuint *) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, sizeof(GLuint) * READBACK_RING_SIZE, flags);
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
 }
 
 /* Visualize voxels */
 void VoxelShader::render(const CloudVolume *volume, const glm::mat4 &P, const glm::mat4 &V) {
-    updateVoxelData(volume);
+    int numVoxels = volume->dimension * volume->dimension * volume->dimension;
+    if (numVoxels > capacity) {
+        resizeBuffers(numVoxels);
+    }
+    readActiveVoxels();
+    compactVoxels(volume);
+    bind();
 
     /* Bind projeciton, view matrices */
     loadMatrix(getUniform("P"), &P);
@@ -55,14 +58,7 @@ void VoxelShader::render(const CloudVolume *volume, const glm::mat4 &P, const gl
     /* Bind mesh */
     CHECK_GL_CALL(glBindVertexArray(cube->vaoId));
     CHECK_GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cube->eleBufId));
-
-    /* Reupload voxel positions */
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, cubePositionVBO));
-    CHECK_GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * voxelPositions.size(), &voxelPositions[0], GL_DYNAMIC_DRAW));
-
-    /* Reupload voxel data */
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, cubeDataVBO));
-    CHECK_GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * voxelData.size(), &voxelData[0], GL_DYNAMIC_DRAW));
+    CHECK_GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer));
 
     /* Individual voxels */
     loadFloat(getUniform("alpha"), alpha);
@@ -71,7 +67,7 @@ void VoxelShader::render(const CloudVolume *volume, const glm::mat4 &P, const gl
     /* Render voxels */
     if (!disableWhite) {
         loadBool(getUniform("isOutline"), false);
-        CHECK_GL_CALL(glDrawElementsInstanced(GL_TRIANGLES, (int)cube->eleBuf.size(), GL_UNSIGNED_INT, 0, voxelPositions.size()));
+        CHECK_GL_CALL(glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0));
     }
 
     /* Render voxel outlines and bounds */
@@ -80,7 +76,7 @@ void VoxelShader::render(const CloudVolume *volume, const glm::mat4 &P, const gl
  
     /* Individual voxels */
     if (!disableWhite && useOutline) {
-       CHECK_GL_CALL(glDrawElementsInstanced(GL_TRIANGLES, (int)cube->eleBuf.size(), GL_UNSIGNED_INT, 0, voxelPositions.size()));
+        CHECK_GL_CALL(glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0));
     }
 
     /* Bounds */
@@ -88,46 +84,105 @@ void VoxelShader::render(const CloudVolume *volume, const glm::mat4 &P, const gl
         glm::vec3 min(volume->xBounds.x, volume->yBounds.x, volume->zBounds.x);
         glm::vec3 max(volume->xBounds.y, volume->yBounds.y, volume->zBounds.y);
         loadVector(getUniform("voxelSize"), max - min);
-        CHECK_GL_CALL(glDrawElementsInstancedBaseInstance(GL_TRIANGLES, (int)cube->eleBuf.size(), GL_UNSIGNED_INT, 0, 1, voxelPositions.size() - 1));
+        CHECK_GL_CALL(glDrawElementsInstancedBaseInstance(GL_TRIANGLES, (int)cube->eleBuf.size(), GL_UNSIGNED_INT, 0, 1, capacity));
     }
 
     CHECK_GL_CALL(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
 
     /* Clean up */
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    CHECK_GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
     CHECK_GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
     CHECK_GL_CALL(glBindVertexArray(0));
 }
 
-void VoxelShader::updateVoxelData(const CloudVolume *volume) {
-    /* Pull volume data out of GPU */
-    std::vector<float> buffer(voxelData.size());
-    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, volume->volId));
-    CHECK_GL_CALL(glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, buffer.data()));
-    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
-
-    /* Size of voxels in world-space */
-    activeVoxels = 0;
-    for (unsigned int i = 0; i < voxelData.size(); i++) {
-        /* Update voxel data if data exists */
-        float r = buffer[i];
-        if (r) {
-            activeVoxels++;
-            glm::ivec3 voxelIndex = volume->get3DIndices(i);
-            voxelPositions[i] = volume->position + volume->reverseVoxelIndex(voxelIndex);
-            voxelData[i] = r;
-        }
-        /* Otherwise reset data */
-        else {
-            voxelPositions[i].x = 0.f;
-            voxelPositions[i].y = 1000000.f; // ensures instanced voxels won't be rendered
-            voxelPositions[i].z = 0.f;
-            voxelData[i] = 0.f;
-        }
-    }
+/* Append every non-empty voxel and count them in the draw command */
+void VoxelShader::compactVoxels(const CloudVolume *volume) {
+    /* Reset draw command */
+    DrawCommand command = { (GLuint)cube->eleBuf.size(), 0, 0, 0, 0 };
+    CHECK_GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer));
+    CHECK_GL_CALL(glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(DrawCommand), &command));
+    CHECK_GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
 
     /* Update bounds position */
     glm::vec3 min(volume->xBounds.x, volume->yBounds.x, volume->zBounds.x);
     glm::vec3 max(volume->xBounds.y, volume->yBounds.y, volume->zBounds.y);
-    voxelPositions.back() = volume->position + (max + min) / 2.f;
+    glm::vec4 bounds(volume->position + (max + min) / 2.f, 0.f);
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelBuffer));
+    CHECK_GL_CALL(glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * capacity, sizeof(glm::vec4), &bounds));
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+    compactShader->bind();
+    GLuint texture = volume->sparse ? volume->bricks.atlasId : volume->volId;
+    CHECK_GL_CALL(glBindImageTexture(0, texture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R8));
+    compactShader->loadBool(compactShader->getUniform("brickMap"), volume->sparse);
+    compactShader->loadInt(compactShader->getUniform("atlasBricks"), volume->bricks.atlasBricks);
+    if (volume->sparse) {
+        CHECK_GL_CALL(glBindImageTexture(2, volume->bricks.indirectionId, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI));
+    }
+    CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, voxelBuffer));
+    CHECK_GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer));
+    compactShader->loadInt(compactShader->getUniform("voxelDim"), volume->dimension);
+    compactShader->loadVector(compactShader->getUniform("volumeMin"), volume->position + min);
+    compactShader->loadVector(compactShader->getUniform("voxelSize"), volume->voxelSize);
+    compactShader->dispatch(volume->dimension, volume->dimension, volume->dimension);
+    CHECK_GL_CALL(glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT));
+    CHECK_GL_CALL(glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R8));
+    CHECK_GL_CALL(glBindImageTexture(2, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI));
+    compactShader->unbind();
+
+    /* Queue counter readback */
+    GLintptr slot = sizeof(GLuint) * readbackIndex;
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, commandBuffer));
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer));
+    CHECK_GL_CALL(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offsetof(DrawCommand, instanceCount), slot, sizeof(GLuint)));
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    GLsync &fence = readbackFences[readbackIndex];
+    if (fence) {
+        CHECK_GL_CALL(glDeleteSync(fence));
+    }
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readbackIndex = (readbackIndex + 1) % READBACK_RING_SIZE;
+}
+
+/* Take the newest finished counter without waiting on the GPU */
+void VoxelShader::readActiveVoxels() {
+    for (int i = 1; i <= READBACK_RING_SIZE; i++) {
+        int slot = (readbackIndex + READBACK_RING_SIZE - i) % READBACK_RING_SIZE;
+        GLsync &fence = readbackFences[slot];
+        if (!fence) {
+            continue;
+        }
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            activeVoxels = (int) mappedReadback[slot];
+
+            /* Anything older is stale */
+            for (GLsync &old : readbackFences) {
+                if (old) {
+                    CHECK_GL_CALL(glDeleteSync(old));
+                    old = 0;
+                }
+            }
+            return;
+        }
+    }
+}
+
+void VoxelShader::resizeBuffers(int count) {
+    /* One extra slot for the bounds */
+    capacity = count;
+    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, voxelBuffer));
+    CHECK_GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * (capacity + 1), nullptr, GL_DYNAMIC_COPY));
+
+    /* xyz position, w data */
+    CHECK_GL_CALL(glBindVertexArray(cube->vaoId));
+    CHECK_GL_CALL(glEnableVertexAttribArray(2));
+    CHECK_GL_CALL(glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0));
+    CHECK_GL_CALL(glVertexAttribDivisor(2, 1)); 
+    CHECK_GL_CALL(glEnableVertexAttribArray(3));
+    CHECK_GL_CALL(glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)(sizeof(float) * 3)));
+    CHECK_GL_CALL(glVertexAttribDivisor(3, 1));
+    CHECK_GL_CALL(glBindVertexArray(0));
+    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
 }
\ No newline at end of file
@@ -3,17 +3,17 @@
 #define _VOXEL_SHADER_HPP_
 
 #include "Shader.hpp"
+#include "ComputeShader.hpp"
 #include "CloudVolume.hpp"
 
-#include <vector>
-
 class Mesh;
 class VoxelShader : public Shader {
     public:
-        VoxelShader(int count, const std::string &r, const std::string &v, const std::string &f);
+        VoxelShader(int count, const std::string &r, const std::string &v, const std::string &f, const std::string &c);
 
         void render(const CloudVolume *, const glm::mat4 &, const glm::mat4 &);
 
+        /* Read back asynchronously, lags rendering by a few frames */
         int activeVoxels = 0;
         bool useOutline = true;
         bool disableBounds = false;
@@ -23,13 +23,24 @@ class VoxelShader : public Shader {
     private:
         /* Instanced cube mesh data */
         Mesh * cube;
-        GLuint cubePositionVBO;
-        GLuint cubeDataVBO;
 
-        /* Voxels */
-        void updateVoxelData(const CloudVolume *);
-        std::vector<glm::vec3> voxelPositions;
-        std::vector<float> voxelData;
+        /* Voxels
+         * Non-empty voxels are appended to voxelBuffer by a compute pass that
+         * also fills the indirect draw command - the slot past capacity holds the bounds */
+        ComputeShader * compactShader;
+        void compactVoxels(const CloudVolume *);
+        void resizeBuffers(int);
+        int capacity = 0;
+        GLuint voxelBuffer;
+        GLuint commandBuffer;
+
+        /* Active voxel count readback ring */
+        static const int READBACK_RING_SIZE = 3;
+        void readActiveVoxels();
+        GLuint readbackBuffer;
+        GLuint *mappedReadback = nullptr;
+        GLsync readbackFences[READBACK_RING_SIZE] = { 0 };
+        int readbackIndex = 0;
 };
 
 #endif
\ No newline at end of file
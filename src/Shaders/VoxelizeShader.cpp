@@ -1,41 +1,161 @@
 #include "VoxelizeShader.hpp"
 
+#include "BillboardSortShader.hpp"
 #include "Library.hpp"
+#include "Util.hpp"
 
 #include "Camera.hpp"
 #include "Sun.hpp"
 #include "IO/Window.hpp"
 
-VoxelizeShader::VoxelizeShader(const std::string &r, const std::string &v1, const std::string &v2, const std::string &f1, const std::string &f2) {
+VoxelizeShader::VoxelizeShader(const std::string &r, const std::string &v1, const std::string &v2, const std::string &f1, const std::string &f2, const std::string &c, const std::string &m, const std::string &o, const std::string &d, const std::string &t) {
     /* Initialize shaders */
     firstVoxelizer  = new Shader(r, v1, f1); // instanced billboard voxelization
-    secondVoxelizer = new Shader(r, v2, f2); // full-screen position map voxelization
-
-    /* Create position map */
-    initPositionFBO(Window::width, Window::height);
+    secondVoxelizer = new Shader(r, v2, f2); // full-screen light depth map voxelization
+    computeVoxelizer = new ComputeShader(r, c); // single dispatch sphere voxelization
+    mipShader = new MipShader(r, m);            // region mip pyramid
+    octreeShader = new OctreeShader(r, o);      // sparse voxel octree
+    densityVoxelizer = new ComputeShader(r, d); // accumulated sphere density
+    transmittanceShader = new TransmittanceShader(r, t); // light transmittance sweep
+
+    /* Create light depth map */
+    initLightFBO();
 }
 
 void VoxelizeShader::voxelize(CloudVolume *volume) {
-    /* Resize position map if window was resized */
-    if (Window::width != positionMap->width || Window::height != positionMap->height) {
-        resizePositionFBO(Window::width, Window::height);
+    /* Skip if the volume would come out the same */
+    uint64_t hash = inputHash(volume);
+    ranThisFrame = !skipUnchanged || !hasVoxelized || hash != lastInputHash;
+    if (!ranThisFrame) {
+        skipCount++;
+        return;
+    }
+    runCount++;
+    volume->voxelGeneration++;
+    lastInputHash = hash;
+    hasVoxelized = true;
+
+    /* Light maps follow the volume resolution */
+    int size = volume->dimension * lightMapScale;
+    if (size != lightMapSize || halfDepth != uploadedHalfDepth) {
+        resizeLightMaps(size);
+    }
+
+    /* Sparse volumes allocate and free the bricks whose occupancy changed */
+    glm::ivec3 boardsMin, boardsMax;
+    volume->boardVoxelBounds(boardsMin, boardsMax);
+    if (volume->sparse) {
+        volume->bricks.allocate(volume);
+    }
+
+    /* Dirty region covers what the last voxelization wrote and what this one can write
+     * A repacked atlas has lost every brick */
+    if (!regionUpdates || (volume->sparse && volume->bricks.repacked)) {
+        dirtyMin = glm::ivec3(0);
+        dirtyMax = glm::ivec3(volume->dimension);
+    }
+    else if (glm::any(glm::lessThanEqual(volume->writtenMax, volume->writtenMin))) {
+        dirtyMin = boardsMin;
+        dirtyMax = boardsMax;
+    }
+    else if (glm::any(glm::lessThanEqual(boardsMax, boardsMin))) {
+        dirtyMin = volume->writtenMin;
+        dirtyMax = volume->writtenMax;
+    }
+    else {
+        dirtyMin = glm::min(boardsMin, volume->writtenMin);
+        dirtyMax = glm::max(boardsMax, volume->writtenMax);
     }
 
-    /* Reset volume and position map */
-    volume->clearGPU();
-    clearPositionMap();
+    /* Reset dirty region */
+    if (volume->sparse) {
+        volume->bricks.clearGPU(dirtyMin, dirtyMax);
+    }
+    else {
+        volume->clearGPU(dirtyMin, dirtyMax);
+    }
 
     /* Voxelize */
-    firstVoxelize(volume);
-    secondVoxelize(volume);
+    if (accumulateDensity) {
+        dispatchDensity(volume);
+    }
+    else if (useCompute) {
+        dispatchVoxelize(volume);
+    }
+    else {
+        clearLightDepthMap();
+        firstVoxelize(volume);
+        secondVoxelize(volume);
+    }
+    volume->writtenMin = boardsMin;
+    volume->writtenMax = boardsMax;
+
+    /* Generate volume mips now that it is done being updated */
+    buildMips(volume);
+
+    /* Octree levels filter the same way as the mips */
+    if (volume->octree.enabled) {
+        octreeShader->build(volume, mipShader->reduction);
+    }
+
+    /* Precompute light reaching every voxel */
+    if (volume->light.enabled && !volume->sparse) {
+        transmittanceShader->build(volume);
+    }
+}
+
+/* Sparse mips only cover the atlas bricks that were cleared */
+void VoxelizeShader::buildMips(CloudVolume *volume) {
+    GLuint texture = volume->sparse ? volume->bricks.atlasId : volume->volId;
+    int levels = volume->sparse ? volume->bricks.levels : volume->levels;
+    if (computeMips && volume->sparse) {
+        mipShader->build(texture, levels, volume->bricks.updatedMin, volume->bricks.updatedMax);
+    }
+    else if (computeMips) {
+        mipShader->build(texture, levels, dirtyMin, dirtyMax);
+    }
+    else {
+        CHECK_GL_CALL(glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, texture));
+        CHECK_GL_CALL(glGenerateMipmap(GL_TEXTURE_3D));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    }
+}
+
+uint64_t VoxelizeShader::inputHash(const CloudVolume *volume) const {
+    uint64_t hash = Util::HASH_SEED;
+    Util::hash(hash, Sun::position);
+    Util::hash(hash, volume->position);
+    Util::hash(hash, volume->xBounds);
+    Util::hash(hash, volume->yBounds);
+    Util::hash(hash, volume->zBounds);
+    Util::hash(hash, volume->dimension);
+    Util::hash(hash, volume->levels);
+    Util::hash(hash, volume->fluffiness);
+    Util::hash(hash, volume->halfFloatInstances);
+    Util::hash(hash, volume->billboards.generation);
+    Util::hash(hash, useCompute);
+    Util::hash(hash, accumulateDensity);
+    Util::hash(hash, densityScale);
+    Util::hash(hash, lightMapScale);
+    Util::hash(hash, halfDepth);
+    Util::hash(hash, volume->sparse);
+    Util::hash(hash, volume->octree.enabled);
+    Util::hash(hash, volume->octree.generation);
+    Util::hash(hash, volume->light.enabled);
+    Util::hash(hash, volume->light.extinction);
+    Util::hash(hash, computeMips);
+    Util::hash(hash, mipShader->reduction);
+    return hash;
 }
 
 /* First voxelize pass 
  * Render all billboards and initialize black voxels
- * Write out nearest voxel positions to position FBO */
+ * Write out nearest light-view depths to the light depth map */
 void VoxelizeShader::firstVoxelize(CloudVolume *volume) {
-    /* Bind position FBO */
-    CHECK_GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, positionFBO));
+    /* Bind light FBO */
+    CHECK_GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, lightFBO));
+    CHECK_GL_CALL(glViewport(0, 0, lightMapSize, lightMapSize));
     CHECK_GL_CALL(glClearColor(0.f, 0.f, 0.f, 0.f));
     CHECK_GL_CALL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
 
@@ -55,6 +175,7 @@ void VoxelizeShader::firstVoxelize(CloudVolume *volume) {
     firstVoxelizer->loadVector(firstVoxelizer->getUniform("lightNearPlane"), Sun::nearPlane);
     firstVoxelizer->loadFloat(firstVoxelizer->getUniform("clipDistance"), Sun::clipDistance);
     firstVoxelizer->loadVector(firstVoxelizer->getUniform("volumePosition"), volume->position);
+    firstVoxelizer->loadFloat(firstVoxelizer->getUniform("fluffiness"), volume->fluffiness);
 
     /* Bind instanced quad */
     CHECK_GL_CALL(glBindVertexArray(volume->instancedQuad->vaoId));
@@ -67,13 +188,15 @@ void VoxelizeShader::firstVoxelize(CloudVolume *volume) {
     unbindVolume();
     firstVoxelizer->unbind();
     CHECK_GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    CHECK_GL_CALL(glViewport(0, 0, Window::width, Window::height));
 }
 
 /* Second voxelize pass 
- * Render position map 
+ * Render light depth map and rebuild world positions from it
  * Highlight voxels nearest to light */
 void VoxelizeShader::secondVoxelize(CloudVolume *volume) {
     /* Disable quad visualization */
+    CHECK_GL_CALL(glViewport(0, 0, lightMapSize, lightMapSize));
     CHECK_GL_CALL(glDisable(GL_DEPTH_TEST));
     CHECK_GL_CALL(glDisable(GL_CULL_FACE));
     CHECK_GL_CALL(glDepthMask(GL_FALSE));
@@ -83,9 +206,18 @@ void VoxelizeShader::secondVoxelize(CloudVolume *volume) {
 
     /* Bind volume */
     bindVolume(secondVoxelizer, volume);
+    bindBricks(secondVoxelizer, volume);
+
+    /* Bind light depth map */
+    CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + lightDepthMap->textureId));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, lightDepthMap->textureId));
+    secondVoxelizer->loadInt(secondVoxelizer->getUniform("lightDepthMap"), lightDepthMap->textureId);
 
-    /* Bind position FBO */
-    CHECK_GL_CALL(glBindImageTexture(1, positionMap->textureId, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32F));
+    /* Bind light's inverse matrices to rebuild world positions */
+    glm::mat4 lightPi = glm::inverse(Sun::P);
+    glm::mat4 lightVi = glm::inverse(Sun::V);
+    secondVoxelizer->loadMatrix(secondVoxelizer->getUniform("lightPi"), &lightPi);
+    secondVoxelizer->loadMatrix(secondVoxelizer->getUniform("lightVi"), &lightVi);
 
     /* Bind quad */
     CHECK_GL_CALL(glBindVertexArray(Library::quad->vaoId));
@@ -100,13 +232,11 @@ void VoxelizeShader::secondVoxelize(CloudVolume *volume) {
     
     /* Draw full screen quad */
     CHECK_GL_CALL(glDrawArrays(GL_TRIANGLE_STRIP, 0, 4));
-
-    /* Generate volume mips now that it is done being updated */
-    CHECK_GL_CALL(glGenerateMipmap(GL_TEXTURE_3D));
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
 
     /* Wrap up shader*/
     CHECK_GL_CALL(glBindVertexArray(0));
-    CHECK_GL_CALL(glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32F));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
     unbindVolume();
     secondVoxelizer->unbind();
 
@@ -115,11 +245,117 @@ void VoxelizeShader::secondVoxelize(CloudVolume *volume) {
     CHECK_GL_CALL(glEnable(GL_CULL_FACE));
     CHECK_GL_CALL(glDepthMask(GL_TRUE));
     CHECK_GL_CALL(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
+    CHECK_GL_CALL(glViewport(0, 0, Window::width, Window::height));
+}
+
+/* Compute voxelize
+ * Each work group rasterizes one billboard sphere into the light-space depth
+ * grid, then a resolve pass writes one voxel per texel for the nearest surface */
+void VoxelizeShader::dispatchVoxelize(CloudVolume *volume) {
+    if (!volume->billboards.count) {
+        return;
+    }
+
+    const GLuint farthest = 0xFFFFFFFF;
+    CHECK_GL_CALL(glClearTexImage(lightDepthGrid, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &farthest));
+
+    computeVoxelizer->bind();
+    bindVolume(computeVoxelizer, volume);
+    bindBricks(computeVoxelizer, volume);
+    volume->bindBillboardBuffer(BillboardSortShader::BOARD_BINDING);
+    CHECK_GL_CALL(glBindImageTexture(1, lightDepthGrid, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI));
+
+    loadLightExtents(computeVoxelizer);
+    computeVoxelizer->loadVector(computeVoxelizer->getUniform("volumePosition"), volume->position);
+    computeVoxelizer->loadFloat(computeVoxelizer->getUniform("fluffiness"), volume->fluffiness);
+    computeVoxelizer->loadBool(computeVoxelizer->getUniform("halfInstances"), volume->halfFloatInstances);
+
+    /* Depth pass then resolve pass */
+    int groupWidth = computeVoxelizer->localSize.x;
+    int groupHeight = computeVoxelizer->localSize.y;
+    computeVoxelizer->loadBool(computeVoxelizer->getUniform("resolvePass"), false);
+    computeVoxelizer->dispatch(volume->billboards.count * groupWidth, groupHeight);
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+    computeVoxelizer->loadBool(computeVoxelizer->getUniform("resolvePass"), true);
+    computeVoxelizer->dispatch(volume->billboards.count * groupWidth, groupHeight);
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+
+    /* Wrap up */
+    CHECK_GL_CALL(glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI));
+    unbindVolume();
+    computeVoxelizer->unbind();
+}
+
+/* Density voxelize
+ * Each work group walks the chords of one billboard sphere through the light-space
+ * grid adding sphere-weighted density with atomics, then a resolve pass maps the
+ * accumulated density to opacity in the volume
+ * Density is only accumulated over the dirty region, so sparse volumes never
+ * pay for a dense R32UI grid unless their billboards span the whole volume */
+void VoxelizeShader::dispatchDensity(CloudVolume *volume) {
+    glm::ivec3 regionMin = dirtyMin;
+    glm::ivec3 regionMax = dirtyMax;
+    glm::ivec3 size = regionMax - regionMin;
+    if (size.x <= 0 || size.y <= 0 || size.z <= 0 || !volume->billboards.count) {
+        return;
+    }
+
+    /* Grow to fit the region, shrink once it's far larger than needed */
+    bool fits = glm::all(glm::lessThanEqual(size, densitySize));
+    long long needed = (long long)size.x * size.y * size.z;
+    long long allocated = (long long)densitySize.x * densitySize.y * densitySize.z;
+    if (!fits || needed * 8 < allocated) {
+        resizeDensityVolume(size);
+    }
+    CHECK_GL_CALL(glClearTexSubImage(densityVolume, 0, 0, 0, 0, size.x, size.y, size.z, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr));
+
+    densityVoxelizer->bind();
+    bindVolume(densityVoxelizer, volume);
+    bindBricks(densityVoxelizer, volume);
+    volume->bindBillboardBuffer(BillboardSortShader::BOARD_BINDING);
+    CHECK_GL_CALL(glBindImageTexture(1, densityVolume, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI));
+
+    loadLightExtents(densityVoxelizer);
+    densityVoxelizer->loadVector(densityVoxelizer->getUniform("volumePosition"), volume->position);
+    densityVoxelizer->loadFloat(densityVoxelizer->getUniform("fluffiness"), volume->fluffiness);
+    densityVoxelizer->loadBool(densityVoxelizer->getUniform("halfInstances"), volume->halfFloatInstances);
+    densityVoxelizer->loadFloat(densityVoxelizer->getUniform("sampleWeight"), 1.f / (lightMapScale * lightMapScale));
+    densityVoxelizer->loadFloat(densityVoxelizer->getUniform("densityScale"), densityScale);
+    densityVoxelizer->loadVector(densityVoxelizer->getUniform("regionMin"), regionMin);
+    densityVoxelizer->loadVector(densityVoxelizer->getUniform("regionMax"), regionMax);
+
+    /* Accumulate pass then resolve pass */
+    densityVoxelizer->loadBool(densityVoxelizer->getUniform("resolvePass"), false);
+    densityVoxelizer->dispatch(volume->billboards.count * densityVoxelizer->localSize.x, densityVoxelizer->localSize.y);
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+    densityVoxelizer->loadBool(densityVoxelizer->getUniform("resolvePass"), true);
+    densityVoxelizer->dispatch(size.x, size.y, size.z);
+    CHECK_GL_CALL(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+
+    /* Wrap up */
+    CHECK_GL_CALL(glBindImageTexture(1, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI));
+    unbindVolume();
+    densityVoxelizer->unbind();
+}
+
+/* Recover the light's orthographic extents from its projection */
+void VoxelizeShader::loadLightExtents(Shader *shader) {
+    glm::mat4 Vi = glm::inverse(Sun::V);
+    glm::vec2 lightMin = glm::vec2(
+        (-1.f - Sun::P[3][0]) / Sun::P[0][0],
+        (-1.f - Sun::P[3][1]) / Sun::P[1][1]);
+    float lightWidth = 2.f / Sun::P[0][0];
+    shader->loadMatrix(shader->getUniform("lightV"), &Sun::V);
+    shader->loadMatrix(shader->getUniform("lightVi"), &Vi);
+    shader->loadVector(shader->getUniform("lightMin"), lightMin);
+    shader->loadFloat(shader->getUniform("lightTexelSize"), lightWidth / lightMapSize);
+    shader->loadInt(shader->getUniform("lightMapSize"), lightMapSize);
 }
 
 void VoxelizeShader::bindVolume(Shader *shader, CloudVolume *volume) {
+    GLuint texture = volume->sparse ? volume->bricks.atlasId : volume->volId;
     CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + volume->volId));
-    CHECK_GL_CALL(glBindImageTexture(0, volume->volId, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R8));
+    CHECK_GL_CALL(glBindImageTexture(0, texture, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R8));
   
     shader->loadVector(shader->getUniform("xBounds"), volume->position.x + volume->xBounds);
     shader->loadVector(shader->getUniform("yBounds"), volume->position.y + volume->yBounds);
@@ -128,60 +364,85 @@ void VoxelizeShader::bindVolume(Shader *shader, CloudVolume *volume) {
     shader->loadFloat(shader->getUniform("stepSize"), glm::min(volume->voxelSize.x, glm::min(volume->voxelSize.y, volume->voxelSize.z)));
 }
 
+/* Route voxel writes through the brick indirection */
+void VoxelizeShader::bindBricks(Shader *shader, CloudVolume *volume) {
+    shader->loadBool(shader->getUniform("brickMap"), volume->sparse);
+    shader->loadInt(shader->getUniform("atlasBricks"), volume->bricks.atlasBricks);
+    if (volume->sparse) {
+        CHECK_GL_CALL(glBindImageTexture(2, volume->bricks.indirectionId, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI));
+    }
+}
+
 void VoxelizeShader::unbindVolume() {
     CHECK_GL_CALL(glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R8));
+    CHECK_GL_CALL(glBindImageTexture(2, 0, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32UI));
     CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0));
 }
 
-void VoxelizeShader::initPositionFBO(const int width, const int height) {
-    /* Generate FBO */
-    CHECK_GL_CALL(glGenFramebuffers(1, &positionFBO));
-    CHECK_GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, positionFBO));
-
-    /* Generate color attachment texture */
-    positionMap = new Texture();
-    positionMap->width = width;
-    positionMap->height = height;
-    CHECK_GL_CALL(glGenTextures(1, &positionMap->textureId));
-    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, positionMap->textureId));
-    CHECK_GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, positionMap->width, positionMap->height, 0, GL_RGBA, GL_FLOAT, NULL));
-    CHECK_GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, positionMap->textureId, 0));
-
-    /* Texture params */
+void VoxelizeShader::initLightFBO() {
+    CHECK_GL_CALL(glGenFramebuffers(1, &lightFBO));
+    lightDepthMap = new Texture();
+    CHECK_GL_CALL(glGenRenderbuffers(1, &lightDepthBuffer));
+}
+
+/* (Re)create light-space maps at a new resolution
+ * Depth map is mutable storage so its format can change in place */
+void VoxelizeShader::resizeLightMaps(const int size) {
+    lightMapSize = size;
+    uploadedHalfDepth = halfDepth;
+
+    /* Depth color attachment */
+    if (!lightDepthMap->textureId) {
+        CHECK_GL_CALL(glGenTextures(1, &lightDepthMap->textureId));
+    }
+    lightDepthMap->width = size;
+    lightDepthMap->height = size;
+    lightDepthMap->components = 1;
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, lightDepthMap->textureId));
+    CHECK_GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, halfDepth ? GL_R16F : GL_R32F, size, size, 0, GL_RED, GL_FLOAT, NULL));
     CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
     CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
     CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
     CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
 
-    /* Generate depth attachment texture */
-    depthMap = new Texture();
-    depthMap->width = width;
-    depthMap->height = height;
-    CHECK_GL_CALL(glGenRenderbuffers(1, &depthMap->textureId));
-    CHECK_GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, depthMap->textureId));
-    CHECK_GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, depthMap->width, depthMap->height));
-    CHECK_GL_CALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthMap->textureId));
+    /* Depth test attachment */
+    CHECK_GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, lightDepthBuffer));
+    CHECK_GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, size, size));
+    CHECK_GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, 0));
 
-    /* Clean up */
+    CHECK_GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, lightFBO));
+    CHECK_GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lightDepthMap->textureId, 0));
+    CHECK_GL_CALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, lightDepthBuffer));
     CHECK_GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
-}
 
-void VoxelizeShader::resizePositionFBO(const int width, const int height) {
-    /* Resize color attachment */
-    positionMap->width = width;
-    positionMap->height = height;
-    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, positionMap->textureId));
-    CHECK_GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, positionMap->width, positionMap->height, 0, GL_RGBA, GL_FLOAT, NULL));
+    /* Compute voxelize grid, immutable so recreated */
+    if (lightDepthGrid) {
+        CHECK_GL_CALL(glDeleteTextures(1, &lightDepthGrid));
+    }
+    CHECK_GL_CALL(glGenTextures(1, &lightDepthGrid));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, lightDepthGrid));
+    CHECK_GL_CALL(glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, size, size));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
     CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+}
 
-    /* Resize depth attachment */
-    depthMap->width = width;
-    depthMap->height = height;
-    CHECK_GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, depthMap->textureId));
-    CHECK_GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, depthMap->width, depthMap->height));
-    CHECK_GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, 0));
+/* Accumulation volume matches the dense volume, immutable so recreated */
+void VoxelizeShader::resizeDensityVolume(const glm::ivec3 &size) {
+    densitySize = size;
+    if (densityVolume) {
+        CHECK_GL_CALL(glDeleteTextures(1, &densityVolume));
+    }
+    CHECK_GL_CALL(glGenTextures(1, &densityVolume));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, densityVolume));
+    CHECK_GL_CALL(glTexStorage3D(GL_TEXTURE_3D, 1, GL_R32UI, size.x, size.y, size.z));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    CHECK_GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+    CHECK_GL_CALL(glClearTexImage(densityVolume, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr));
 }
 
-void VoxelizeShader::clearPositionMap() {
-    CHECK_GL_CALL(glClearTexImage(positionMap->textureId, 0, GL_RGBA, GL_FLOAT, nullptr));
+void VoxelizeShader::clearLightDepthMap() {
+    CHECK_GL_CALL(glClearTexImage(lightDepthMap->textureId, 0, GL_RED, GL_FLOAT, nullptr));
 }
\ No newline at end of file
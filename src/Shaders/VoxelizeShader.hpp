@@ -3,35 +3,86 @@
 #define _VOXELIZE_SHADER_HPP_
 
 #include "Shader.hpp"
+#include "ComputeShader.hpp"
+#include "MipShader.hpp"
+#include "OctreeShader.hpp"
+#include "TransmittanceShader.hpp"
 
 #include "Model/Texture.hpp"
 #include "CloudVolume.hpp"
 
 class VoxelizeShader {
     public:
-        VoxelizeShader(const std::string &, const std::string &, const std::string &, const std::string &, const std::string &);
+        VoxelizeShader(const std::string &, const std::string &, const std::string &, const std::string &, const std::string &, const std::string &, const std::string &, const std::string &, const std::string &, const std::string &);
 
         Shader * firstVoxelizer;
         Shader * secondVoxelizer;
+        ComputeShader * computeVoxelizer;
+        MipShader * mipShader;
+        OctreeShader * octreeShader;
+        ComputeShader * densityVoxelizer;
+        TransmittanceShader * transmittanceShader;
 
-        /* Generate 3D volume */
+        /* Generate 3D volume
+         * Skipped when none of the inputs changed since the last run */
         void voxelize(CloudVolume *);
+        bool skipUnchanged = true;
+        bool ranThisFrame = false;
+        int runCount = 0;
+        int skipCount = 0;
 
-        /* 2D position FBO */
-        GLuint positionFBO;
-        Texture * positionMap;
-        Texture * depthMap;
-        void clearPositionMap();
+        /* Only clear and re-mip the voxels this and the last voxelization can touch
+         * Mips are built in compute passes, or by glGenerateMipmap over the whole volume */
+        bool regionUpdates = true;
+        bool computeMips = true;
+        glm::ivec3 dirtyMin = glm::ivec3(0);
+        glm::ivec3 dirtyMax = glm::ivec3(0);
+
+        /* Light-space depth map
+         * Sized lightMapScale texels per voxel and independent of the window
+         * Only light-view depth is stored, world position is rebuilt from the light's matrices */
+        int lightMapScale = 4;
+        int lightMapSize = 0;
+        bool halfDepth = false;             // R16F instead of R32F depth
+        GLuint lightFBO;
+        Texture * lightDepthMap;
+        GLuint lightDepthBuffer;
+        void clearLightDepthMap();
+
+        /* Voxelize billboard spheres directly in a compute pass
+         * Nearest surfaces are resolved with atomics in an R32UI light-space grid */
+        bool useCompute = false;
+        GLuint lightDepthGrid = 0;
+
+        /* Accumulate sphere-weighted density with atomic adds into an R32UI volume
+         * instead of marking the nearest surface, then resolve it to opacity
+         * Overlapping billboards come out thicker rather than saturating */
+        bool accumulateDensity = false;
+        float densityScale = 1.f;           // Opacity per unit of accumulated density
+        GLuint densityVolume = 0;           // Covers only the dirty region, offset by its min
+        glm::ivec3 densitySize = glm::ivec3(0);
 
     private:
+        /* Hash of everything the voxelized volume depends on */
+        uint64_t inputHash(const CloudVolume *) const;
+        uint64_t lastInputHash = 0;
+        bool hasVoxelized = false;
+
         void firstVoxelize(CloudVolume *);
         void secondVoxelize(CloudVolume *);
+        void dispatchVoxelize(CloudVolume *);
+        void dispatchDensity(CloudVolume *);
+        void loadLightExtents(Shader *);
+        void buildMips(CloudVolume *);
         
         void bindVolume(Shader *, CloudVolume *);
+        void bindBricks(Shader *, CloudVolume *);
         void unbindVolume();
 
-        void initPositionFBO(const int, const int);
-        void resizePositionFBO(const int, const int);
+        void initLightFBO();
+        void resizeLightMaps(const int);
+        void resizeDensityVolume(const glm::ivec3 &);
+        bool uploadedHalfDepth = false;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "SparseOctree.hpp"
+
+#include "Shaders/GLSL.hpp"
+
+#include "glm/glm.hpp"
+
+/* Matches the Header block in octree_build_comp.glsl */
+static const GLsizeiptr HEADER_SIZE = sizeof(GLuint) * (8 + SparseOctree::MAX_LEVELS + 2);
+static const GLintptr COUNT_OFFSET = sizeof(GLuint) * 6;
+
+SparseOctree::SparseOctree() {
+    CHECK_GL_CALL(glGenBuffers(1, &nodeBuffer));
+    CHECK_GL_CALL(glGenBuffers(1, &fragmentBuffer));
+    CHECK_GL_CALL(glGenBuffers(1, &headerBuffer));
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, headerBuffer));
+    CHECK_GL_CALL(glBufferData(GL_SHADER_STORAGE_BUFFER, HEADER_SIZE, nullptr, GL_DYNAMIC_COPY));
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+    resizeNodes(1 << 16);
+    resizeFragments(1 << 15);
+
+    /* Persistently mapped fragment and node count readback */
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    CHECK_GL_CALL(glGenBuffers(1, &countBuffer));
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, countBuffer));
+    CHECK_GL_CALL(glBufferStorage(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * 2, nullptr, flags));
+    mappedCounts = (GLuint *) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, sizeof(GLuint) * 2, flags);
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+}
+
+SparseOctree::~SparseOctree() {
+    if (countFence) {
+        CHECK_GL_CALL(glDeleteSync(countFence));
+    }
+    GLuint buffers[] = { nodeBuffer, fragmentBuffer, headerBuffer, countBuffer };
+    CHECK_GL_CALL(glDeleteBuffers(4, buffers));
+}
+
+/* Copy the build's counters out once the build commands are queued */
+void SparseOctree::queueCountReadback() {
+    if (countFence) {
+        CHECK_GL_CALL(glDeleteSync(countFence));
+    }
+    CHECK_GL_CALL(glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT));
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, headerBuffer));
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, countBuffer));
+    CHECK_GL_CALL(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, COUNT_OFFSET, 0, sizeof(GLuint) * 2));
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    CHECK_GL_CALL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    countFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/* Pick up finished counts without waiting, grow the pools if the build overflowed */
+void SparseOctree::pollCountReadback() {
+    if (!countFence) {
+        return;
+    }
+    GLenum status = glClientWaitSync(countFence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+        return;
+    }
+    CHECK_GL_CALL(glDeleteSync(countFence));
+    countFence = 0;
+
+    fragmentCount = (int) mappedCounts[0];
+    nodeCount = (int) mappedCounts[1];
+    if (fragmentCount > fragmentCapacity) {
+        resizeFragments(glm::max(fragmentCount, 2 * fragmentCapacity));
+        generation++;
+    }
+    if (nodeCount > nodeCapacity) {
+        resizeNodes(glm::max(nodeCount, 2 * nodeCapacity));
+        generation++;
+    }
+}
+
+size_t SparseOctree::nodeBytes() const {
+    return (size_t)glm::min(nodeCount, nodeCapacity) * sizeof(GLuint) * 2;
+}
+
+void SparseOctree::resizeNodes(int capacity) {
+    nodeCapacity = capacity;
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeBuffer));
+    CHECK_GL_CALL(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 2 * nodeCapacity, nullptr, GL_DYNAMIC_COPY));
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+void SparseOctree::resizeFragments(int capacity) {
+    fragmentCapacity = capacity;
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, fragmentBuffer));
+    CHECK_GL_CALL(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 2 * fragmentCapacity, nullptr, GL_DYNAMIC_COPY));
+    CHECK_GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+/* Sparse voxel octree
+ * GPU node pool built from the voxelized volume, interior nodes hold
+ * filtered density so each octree level matches a volume mip */
+#pragma once
+#ifndef _SPARSE_OCTREE_HPP_
+#define _SPARSE_OCTREE_HPP_
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+class SparseOctree {
+    public:
+        SparseOctree();
+        ~SparseOctree();
+
+        /* Build after voxelization and cone trace through the octree */
+        bool enabled = false;
+
+        /* SSBO bindings shared with octree_build_comp.glsl and conetrace_frag.glsl */
+        static const GLuint NODE_BINDING = 3;
+        static const GLuint FRAGMENT_BINDING = 4;
+        static const GLuint HEADER_BINDING = 5;
+
+        /* Deepest level supported by the 10 bit fragment coordinates */
+        static const int MAX_LEVELS = 10;
+
+        GLuint nodeBuffer;
+        GLuint fragmentBuffer;
+        GLuint headerBuffer;
+        int depth = 0;
+        int nodeCapacity = 0;
+        int fragmentCapacity = 0;
+
+        /* Counts from the last finished build, read back asynchronously
+         * A build that overflowed grows the pools and bumps the generation */
+        int nodeCount = 0;
+        int fragmentCount = 0;
+        unsigned int generation = 0;
+        void queueCountReadback();
+        void pollCountReadback();
+        size_t nodeBytes() const;
+
+    private:
+        void resizeNodes(int);
+        void resizeFragments(int);
+
+        GLuint countBuffer;
+        GLuint *mappedCounts = nullptr;
+        GLsync countFence = 0;
+};
+
+#endif
\ No newline at end of file
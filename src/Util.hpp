@@ -7,6 +7,10 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
 
 class Util {
     public:
@@ -44,6 +48,40 @@ class Util {
             return glm::vec3(genRandom(xmin, xmax), genRandom(ymin, ymax), genRandom(zmin, zmax));
         }
 
+        //////////////////////////////////////////////
+        //                  HASHING                 //
+        //////////////////////////////////////////////
+        /* Fold raw bytes into a running FNV-1a hash */
+        static inline void hashBytes(uint64_t &hash, const void *data, const size_t size) {
+            const unsigned char *bytes = (const unsigned char *) data;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+        }
+        /* Fold a plain value into a running hash */
+        template <typename T>
+        static inline void hash(uint64_t &hash, const T &value) {
+            hashBytes(hash, &value, sizeof(T));
+        }
+        /* Starting value for a running hash */
+        static constexpr uint64_t HASH_SEED = 14695981039346656037ull;
+
+        //////////////////////////////////////////////
+        //                 THREADING                //
+        //////////////////////////////////////////////
+        /* Run a job across workers with the calling thread taking the first slice */
+        static void parallelFor(unsigned int workers, const std::function<void(unsigned int)> &job) {
+            std::vector<std::thread> threads;
+            for (unsigned int t = 1; t < workers; t++) {
+                threads.emplace_back(job, t);
+            }
+            job(0);
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+        }
+
         //////////////////////////////////////////////
         //                 PRINTING                 //
         //////////////////////////////////////////////
@@ -0,0 +1,273 @@
+#include "VolumeCache.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char MAGIC[4] = { 'C', 'V', 'O', 'L' };
+static_assert(sizeof(VolumeCache::Header) <= VolumeCache::DATA_OFFSET, "Cache header overlaps texels");
+
+/* Map a whole file read only, returns null if it can't be opened */
+static void * mapFile(const std::string &path, size_t &size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER fileSize;
+    void *view = nullptr;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        size = (size_t) fileSize.QuadPart;
+    }
+    CloseHandle(file);
+    return view;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat info;
+    void *view = nullptr;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        view = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED) {
+            view = nullptr;
+        }
+        size = (size_t) info.st_size;
+    }
+    close(fd);
+    return view;
+#endif
+}
+
+void VolumeCache::makeDirectory(const std::string &directory) {
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+}
+
+VolumeCache::~VolumeCache() {
+    for (std::future<bool> &write : writes) {
+        write.wait();
+    }
+}
+
+VolumeCache::Mapping::~Mapping() {
+    unmap();
+}
+
+void VolumeCache::Mapping::unmap() {
+    if (view) {
+#ifdef _WIN32
+        UnmapViewOfFile(view);
+#else
+        munmap(view, viewSize);
+#endif
+    }
+    view = nullptr;
+    viewSize = 0;
+    data = nullptr;
+    size = 0;
+}
+
+std::string VolumeCache::path(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.vol", (unsigned long long) key);
+    return directory + name;
+}
+
+bool VolumeCache::load(uint64_t key, uint32_t format, int width, int height, int depth, uint32_t texelBytes, Mapping &mapping) {
+    mapping.unmap();
+    if (!enabled) {
+        return false;
+    }
+
+    mapping.view = mapFile(path(key), mapping.viewSize);
+    const uint64_t dataSize = (uint64_t) width * height * depth * texelBytes;
+    const Header *header = (const Header *) mapping.view;
+    if (!header ||
+        mapping.viewSize < DATA_OFFSET + dataSize ||
+        std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) ||
+        header->version != VERSION ||
+        header->key != key ||
+        header->format != format ||
+        header->texelBytes != texelBytes ||
+        header->width != width || header->height != height || header->depth != depth ||
+        header->dataSize != dataSize) {
+        mapping.unmap();
+        misses++;
+        return false;
+    }
+
+    mapping.data = (const char *) mapping.view + DATA_OFFSET;
+    mapping.size = (size_t) dataSize;
+    hits++;
+
+    std::lock_guard<std::mutex> lock(indexMutex);
+    loadIndex();
+    touch(key, mapping.viewSize);
+    saveIndex();
+    return true;
+}
+
+bool VolumeCache::store(uint64_t key, uint32_t format, int width, int height, int depth, uint32_t texelBytes, const void *data) {
+    if (!enabled) {
+        return false;
+    }
+    return write(key, format, width, height, depth, texelBytes, data, budgetBytes);
+}
+
+/* Written under a temporary name and renamed so a crash never leaves a partial file
+ * Settings come in as arguments since writer threads can't read the members safely */
+bool VolumeCache::write(uint64_t key, uint32_t format, int width, int height, int depth, uint32_t texelBytes, const void *data, size_t budget) {
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.key = key;
+    header.format = format;
+    header.texelBytes = texelBytes;
+    header.width = width;
+    header.height = height;
+    header.depth = depth;
+    header.dataSize = (uint64_t) width * height * depth * texelBytes;
+
+    makeDirectory(directory);
+    const std::string finalPath = path(key);
+    const std::string tmpPath = finalPath + ".tmp";
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+    char padding[DATA_OFFSET] = { 0 };
+    bool written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                   fwrite(padding, DATA_OFFSET - sizeof(header), 1, fp) == 1 &&
+                   fwrite(data, (size_t) header.dataSize, 1, fp) == 1;
+    written = fclose(fp) == 0 && written;
+    if (written) {
+        remove(finalPath.c_str());
+        written = rename(tmpPath.c_str(), finalPath.c_str()) == 0;
+    }
+    if (!written) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(indexMutex);
+    loadIndex();
+    touch(key, DATA_OFFSET + header.dataSize);
+    evict(key, budget);
+    saveIndex();
+    return true;
+}
+
+void VolumeCache::launch(std::function<bool()> job) {
+    /* Drop writes that already finished */
+    writes.erase(std::remove_if(writes.begin(), writes.end(), [](std::future<bool> &write) {
+        return write.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), writes.end());
+    writes.push_back(std::async(std::launch::async, job));
+}
+
+int VolumeCache::pendingWrites() {
+    int pending = 0;
+    for (std::future<bool> &write : writes) {
+        pending += write.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    }
+    return pending;
+}
+
+size_t VolumeCache::cachedBytes() {
+    std::lock_guard<std::mutex> lock(indexMutex);
+    loadIndex();
+    uint64_t bytes = 0;
+    for (const auto &entry : entries) {
+        bytes += entry.second.bytes;
+    }
+    return (size_t) bytes;
+}
+
+/* One "key bytes lastUse" line per file, read once per run */
+void VolumeCache::loadIndex() {
+    if (indexLoaded) {
+        return;
+    }
+    indexLoaded = true;
+    FILE *fp = fopen((directory + "volumes.index").c_str(), "r");
+    if (!fp) {
+        return;
+    }
+    unsigned long long key, bytes, lastUse;
+    while (fscanf(fp, "%llx %llu %llu", &key, &bytes, &lastUse) == 3) {
+        entries[key] = { bytes, lastUse };
+        useClock = std::max(useClock, (uint64_t) lastUse);
+    }
+    fclose(fp);
+}
+
+void VolumeCache::saveIndex() {
+    makeDirectory(directory);
+    FILE *fp = fopen((directory + "volumes.index").c_str(), "w");
+    if (!fp) {
+        return;
+    }
+    for (const auto &entry : entries) {
+        fprintf(fp, "%016llx %llu %llu\n", (unsigned long long) entry.first, (unsigned long long) entry.second.bytes, (unsigned long long) entry.second.lastUse);
+    }
+    fclose(fp);
+}
+
+void VolumeCache::touch(uint64_t key, uint64_t bytes) {
+    entries[key] = { bytes, ++useClock };
+}
+
+/* Remove least recently used files until the budget fits, never the one just written
+ * A file that can't be removed (still mapped on Windows) stays indexed for next time */
+void VolumeCache::evict(uint64_t keep, size_t budget) {
+    uint64_t total = 0;
+    for (const auto &entry : entries) {
+        total += entry.second.bytes;
+    }
+    while (total > budget) {
+        auto oldest = entries.end();
+        for (auto entry = entries.begin(); entry != entries.end(); entry++) {
+            if (entry->first != keep && (oldest == entries.end() || entry->second.lastUse < oldest->second.lastUse)) {
+                oldest = entry;
+            }
+        }
+        if (oldest == entries.end()) {
+            return;
+        }
+        std::string file = path(oldest->first);
+        FILE *fp = fopen(file.c_str(), "rb");
+        bool missing = !fp;
+        if (fp) {
+            fclose(fp);
+        }
+        if (!missing && remove(file.c_str()) != 0) {
+            return;
+        }
+        total -= oldest->second.bytes;
+        entries.erase(oldest);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+/* Volume cache
+ * Versioned binary files of generated volumes keyed by a hash of whatever
+ * produced them, so later runs map the texels straight into an upload
+ * instead of regenerating them
+ * Each file is a fixed header followed by tightly packed texels
+ * An index of sizes and last use evicts the least recently used files past a byte budget */
+#pragma once
+#ifndef _VOLUME_CACHE_HPP_
+#define _VOLUME_CACHE_HPP_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+class VolumeCache {
+    public:
+        /* Bumped whenever the header layout changes */
+        static const uint32_t VERSION = 1;
+        static const size_t DATA_OFFSET = 64;
+
+        struct Header {
+            char magic[4];          // "CVOL"
+            uint32_t version;
+            uint64_t key;
+            uint32_t format;        // GL internal format of the texels
+            uint32_t texelBytes;
+            int32_t width;
+            int32_t height;
+            int32_t depth;
+            uint64_t dataSize;
+        };
+
+        /* Read only view of a cache file, unmapped on destruction */
+        class Mapping {
+            public:
+                Mapping() {}
+                ~Mapping();
+                Mapping(const Mapping &) = delete;
+                Mapping & operator=(const Mapping &) = delete;
+
+                const void *data = nullptr;     // First texel
+                size_t size = 0;
+
+            private:
+                friend class VolumeCache;
+                void unmap();
+                void *view = nullptr;
+                size_t viewSize = 0;
+        };
+
+        ~VolumeCache();
+
+        bool enabled = true;
+        std::string directory = "cache/";
+        size_t budgetBytes = 512u << 20;
+        int hits = 0;
+        int misses = 0;
+
+        /* Map the volume stored under a key
+         * Misses if there is no file or it was written with a different version or shape */
+        bool load(uint64_t, uint32_t, int, int, int, uint32_t, Mapping &);
+
+        /* Write a volume under a key, replacing any older file */
+        bool store(uint64_t, uint32_t, int, int, int, uint32_t, const void *);
+
+        /* Same as store on a worker thread that owns the texels
+         * Settings are captured now so the UI can keep changing them */
+        template <typename T>
+        void storeAsync(uint64_t key, uint32_t format, int width, int height, int depth, uint32_t texelBytes, std::vector<T> &&texels) {
+            if (!enabled) {
+                return;
+            }
+            std::shared_ptr<std::vector<T>> data = std::make_shared<std::vector<T>>(std::move(texels));
+            const size_t budget = budgetBytes;
+            launch([=]() {
+                return write(key, format, width, height, depth, texelBytes, data->data(), budget);
+            });
+        }
+
+        /* Bytes of cache files tracked by the index */
+        size_t cachedBytes();
+        int pendingWrites();
+
+        std::string path(uint64_t) const;
+
+        /* Create a cache directory if it doesn't exist yet */
+        static void makeDirectory(const std::string &);
+
+    private:
+        struct Entry {
+            uint64_t bytes;
+            uint64_t lastUse;
+        };
+
+        /* Index state is shared with writer threads */
+        std::mutex indexMutex;
+        std::map<uint64_t, Entry> entries;
+        uint64_t useClock = 0;
+        bool indexLoaded = false;
+        void loadIndex();
+        void saveIndex();
+        void touch(uint64_t, uint64_t);
+        void evict(uint64_t, size_t);
+
+        bool write(uint64_t, uint32_t, int, int, int, uint32_t, const void *, size_t);
+
+        std::vector<std::future<bool>> writes;
+        void launch(std::function<bool()>);
+};
+
+#endif
\ No newline at end of file
@@ -2,19 +2,26 @@
 #include "Camera.hpp"
 #include "Util.hpp"
 #include "Library.hpp"
+#include "Benchmark.hpp"
+#include "QualityGovernor.hpp"
 
 #include "Sun.hpp"
 #include "CloudVolume.hpp"
 
 #include "Shaders/GLSL.hpp"
+#include "Shaders/ProgramCache.hpp"
 #include "Shaders/SunShader.hpp"
 #include "Shaders/VoxelizeShader.hpp"
+#include "Shaders/ClipmapShader.hpp"
 #include "Shaders/VoxelShader.hpp"
 #include "Shaders/ConeTraceShader.hpp"
 
 #include "ThirdParty/imgui/imgui.h"
 
+#include <chrono>
+#include <fstream>
 #include <functional>
+#include <string>
 #include <time.h>
 
 /* Initial values */
@@ -32,6 +39,7 @@ const glm::vec2 I_VOLUME_BOUNDS = glm::vec2(-5.f, 5.f);
 const int I_VOLUME_DIMENSION = 32;
 const int I_VOLUME_MIPS = 4;
 CloudVolume *volume;
+QualityGovernor *governor;
 
 /* Sun */
 glm::vec3 Sun::position = glm::vec3(5.f, 20.f, -5.f);
@@ -45,6 +53,13 @@ glm::vec3 Sun::nearPlane;
 glm::vec3 Sun::farPlane;
 float Sun::clipDistance;
 
+/* Program cache */
+bool ProgramCache::enabled = true;
+std::string ProgramCache::directory = "cache/";
+int ProgramCache::hits = 0;
+int ProgramCache::misses = 0;
+double shaderStartupMs = 0.0;
+
 /* Library things */
 const std::string RESOURCE_DIR("res/");
 Mesh * Library::quad;
@@ -53,6 +68,7 @@ std::map<std::string, Texture *> Library::textures;
 /* Shaders */
 SunShader * sunShader;
 VoxelizeShader * voxelizeShader;
+ClipmapShader * clipmapShader;
 VoxelShader * voxelShader;
 ConeTraceShader * coneShader;
 Shader * debugShader;
@@ -81,12 +97,20 @@ int main() {
     volume = new CloudVolume(I_VOLUME_DIMENSION, I_VOLUME_BOUNDS, I_VOLUME_POSITION, I_VOLUME_MIPS);
     volume->regenerateBillboards(I_VOLUME_BOARDS, glm::vec3(-2.5f), glm::vec3(2.5f), 1.f, 2.5);
 
-    /* Create shaders */
+    /* Create shaders - timed to compare cold and warm program caches */
+    auto shaderStart = std::chrono::high_resolution_clock::now();
     sunShader = new SunShader(RESOURCE_DIR, "billboard_vert.glsl", "sun_frag.glsl");
-    voxelShader = new VoxelShader(volume->dimension, RESOURCE_DIR, "voxel_vert.glsl", "voxel_frag.glsl");
-    voxelizeShader = new VoxelizeShader(RESOURCE_DIR, "billboard_vert_instanced.glsl", "billboard_vert.glsl", "first_voxelize.glsl", "second_voxelize.glsl");
-    coneShader = new ConeTraceShader(RESOURCE_DIR, "billboard_vert_instanced.glsl", "conetrace_frag.glsl");
+    voxelShader = new VoxelShader(volume->dimension, RESOURCE_DIR, "voxel_vert.glsl", "voxel_frag.glsl", "voxel_compact_comp.glsl");
+    voxelizeShader = new VoxelizeShader(RESOURCE_DIR, "billboard_vert_instanced.glsl", "billboard_vert.glsl", "first_voxelize.glsl", "second_voxelize.glsl", "compute_voxelize.glsl", "mip_build_comp.glsl", "octree_build_comp.glsl", "density_voxelize_comp.glsl", "transmittance_comp.glsl");
+    clipmapShader = new ClipmapShader(RESOURCE_DIR, "clipmap_voxelize_comp.glsl", voxelizeShader->mipShader);
+    coneShader = new ConeTraceShader(RESOURCE_DIR, "billboard_vert_instanced.glsl", "conetrace_frag.glsl", "billboard_keys_comp.glsl", "bitonic_sort_comp.glsl", "lighting_cache_comp.glsl", "billboard_vert.glsl", "upsample_frag.glsl", "temporal_resolve_comp.glsl", "noise_bake_comp.glsl");
     debugShader = new Shader(RESOURCE_DIR, "billboard_vert.glsl", "debug_frag.glsl");
+    shaderStartupMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - shaderStart).count();
+    std::cout << "Shaders built in " << shaderStartupMs << " ms - " << ProgramCache::hits << " cached, " << ProgramCache::misses << " compiled ("
+              << (!ProgramCache::enabled ? "cache off" : !ProgramCache::misses ? "warm cache" : !ProgramCache::hits ? "cold cache" : "partial cache") << ")" << std::endl;
+
+    /* Create quality governor */
+    governor = new QualityGovernor;
 
     /* Init rendering state */
     GLSL::checkVersion();
@@ -99,6 +123,9 @@ int main() {
         /* Update context */
         Window::update();
 
+        /* Adapt quality to last frames' GPU time */
+        governor->update(volume, coneShader);
+
         /* Update camera */
         Camera::update();
 
@@ -109,6 +136,7 @@ int main() {
         volume->update();
 
         /* Cloud render! */
+        governor->beginFrame();
         CHECK_GL_CALL(glClearColor(0.2f, 0.3f, 0.5f, 1.f));
         CHECK_GL_CALL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
 
@@ -119,6 +147,10 @@ int main() {
         if (lightVoxelize) {
             voxelizeShader->voxelize(volume);
         }
+        /* Scroll clipmap cascades with the camera */
+        if (volume->clipmap.enabled) {
+            clipmapShader->update(volume, Camera::getPosition());
+        }
         /* Cone trace from the camera's perspective */
         coneShader->coneTrace(volume);
 
@@ -131,6 +163,7 @@ int main() {
             voxelShader->render(volume, P, V);
             voxelShader->unbind();
         }
+        governor->endFrame();
 
         /* IMGUI */
         if (Window::isImGuiEnabled()) {
@@ -148,9 +181,19 @@ void runImGuiPanes() {
         ImGui::Text("dt:        %0.4f", Window::timeStep);
         glm::vec3 pos = Camera::getPosition();
         ImGui::Text("CamPos:    (%0.2f, %0.2f, %0.2f)", pos.x, pos.y, pos.z);
+        ImGui::Text("Upload:    %d bytes", volume->uploadedBytes);
         if (ImGui::Button("Vsync")) {
             Window::toggleVsync();
         }
+        ImGui::Text("Shaders:   %0.1f ms startup", shaderStartupMs);
+        ImGui::Text("Programs:  %d cached / %d compiled", ProgramCache::hits, ProgramCache::misses);
+        ImGui::Checkbox("Program cache", &ProgramCache::enabled);
+        ImGui::Text("GPU:       %0.4f ms", governor->gpuMs);
+        ImGui::Checkbox("Adaptive quality", &governor->enabled);
+        ImGui::SliderFloat("Target ms", &governor->targetMs, 1.f, 33.f);
+        if (ImGui::SliderInt("Quality", &governor->level, 0, QualityGovernor::NUM_LEVELS - 1)) {
+            governor->applyLevel(volume, coneShader);
+        }
     }
     ImGui::End();
 
@@ -170,13 +213,14 @@ void runImGuiPanes() {
 
     /* Render full-screen map */
     if (showFullMap) {
-        const Texture *posMap = voxelizeShader->positionMap;
+        const Texture *depthMap = voxelizeShader->lightDepthMap;
         CHECK_GL_CALL(glClearColor(0.2f, 0.3f, 0.5f, 1.f));
         CHECK_GL_CALL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
         debugShader->bind();
-        CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + posMap->textureId));
-        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, posMap->textureId));
-        debugShader->loadInt(debugShader->getUniform("positionMap"), posMap->textureId);
+        CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0 + depthMap->textureId));
+        CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, depthMap->textureId));
+        debugShader->loadInt(debugShader->getUniform("lightDepthMap"), depthMap->textureId);
+        debugShader->loadFloat(debugShader->getUniform("clipDistance"), Sun::clipDistance);
         CHECK_GL_CALL(glBindVertexArray(Library::quad->vaoId));
         glm::mat4 M = glm::mat4(1.f);
         debugShader->loadMatrix(debugShader->getUniform("P"), &M);
@@ -190,10 +234,10 @@ void runImGuiPanes() {
         debugShader->unbind();
     }
     if (showSmallMap) {
-        ImGui::Begin("Position Map");
-        static float mapSize = 0.2f;
-        ImGui::SliderFloat("Map Size", &mapSize, 0.1f, 1.f);
-        ImGui::Image((ImTextureID)voxelizeShader->positionMap->textureId, ImVec2(voxelizeShader->positionMap->width*mapSize, voxelizeShader->positionMap->height*mapSize));
+        ImGui::Begin("Light Depth Map");
+        static float mapSize = 1.f;
+        ImGui::SliderFloat("Map Size", &mapSize, 0.5f, 4.f);
+        ImGui::Image((ImTextureID)voxelizeShader->lightDepthMap->textureId, ImVec2(voxelizeShader->lightDepthMap->width*mapSize, voxelizeShader->lightDepthMap->height*mapSize));
         ImGui::End();
     }
 
@@ -219,17 +263,27 @@ void runImGuiPanes() {
         if (ImGui::Button("Regenerate billboards") || changing) {
             volume->regenerateBillboards(numBoards, minOff, maxOff, ranScale.x, ranScale.y);
         }
+        ImGui::Checkbox("GPU sort", &coneShader->gpuSort);
+        ImGui::Checkbox("Half float instances", &volume->halfFloatInstances);
+        if (ImGui::Button("Benchmark sort")) {
+            Benchmark::sortBoards();
+        }
+        ImGui::SliderFloat("Sort repair distance", &volume->sortRepairDistance, 0.f, 5.f);
+        CloudVolume::SortStats &sortStats = volume->sortStats;
+        ImGui::Text("Sorts (full/repair/skip): %d / %d / %d", sortStats.fullSorts, sortStats.repairs, sortStats.skips);
+        if (ImGui::Button("Reset sort stats")) {
+            sortStats = CloudVolume::SortStats();
+        }
         if (volume->billboards.count) {
             static int currBoard = 0;
-            ImGui::SliderInt("Curr board", &currBoard, 0, volume->billboards.positions.size() - 1);
-            glm::vec3 *currPos = &volume->billboards.positions[currBoard];
-            float *currScale = &volume->billboards.scales[currBoard];
-            ImGui::SliderFloat3("Position", glm::value_ptr(*currPos), -10.f, 10.f);
-            ImGui::SliderFloat("Cscale", currScale, 1.f, 10.f);
-            if (ImGui::Button("Delete") && volume->billboards.positions.size()) {
-                volume->billboards.positions.erase(volume->billboards.positions.begin() + currBoard);
-                volume->billboards.scales.erase(volume->billboards.scales.begin() + currBoard);
-                volume->billboards.count--;
+            ImGui::SliderInt("Curr board", &currBoard, 0, volume->billboards.count - 1);
+            glm::vec4 *currBoardInstance = &volume->billboards.instances[currBoard];
+            if (ImGui::SliderFloat3("Position", glm::value_ptr(*currBoardInstance), -10.f, 10.f) |
+                ImGui::SliderFloat("Cscale", &currBoardInstance->w, 1.f, 10.f)) {
+                volume->billboards.generation++;
+            }
+            if (ImGui::Button("Delete") && volume->billboards.count) {
+                volume->removeCloudBoard(currBoard);
                 currBoard = glm::max(0, currBoard - 1);
             }
         }
@@ -255,13 +309,83 @@ void runImGuiPanes() {
             volume->resetBillboards();
         }
         ImGui::SliderFloat("Fluffiness", &volume->fluffiness, 0.f, 1.f);
+        int dimensionLog = 0;
+        while ((1 << dimensionLog) < volume->dimension) {
+            dimensionLog++;
+        }
+        if (ImGui::SliderInt("Dimension (log2)", &dimensionLog, 3, 8)) {
+            volume->setDimension(1 << dimensionLog);
+        }
+        ImGui::Text("Dimension : %d^3, %d mips", volume->dimension, volume->levels);
     }
     ImGui::End();
 
     ImGui::Begin("Voxels");
     {
         ImGui::Checkbox("Light Voxelize", &lightVoxelize);
+        ImGui::Checkbox("Skip unchanged voxelize", &voxelizeShader->skipUnchanged);
+        ImGui::Checkbox("Compute voxelize", &voxelizeShader->useCompute);
+        ImGui::Checkbox("Accumulate density", &voxelizeShader->accumulateDensity);
+        if (voxelizeShader->accumulateDensity) {
+            ImGui::SliderFloat("Density scale", &voxelizeShader->densityScale, 0.1f, 8.f);
+            glm::ivec3 densitySize = voxelizeShader->densitySize;
+            ImGui::Text("Density grid : %d x %d x %d (%.1f KB)", densitySize.x, densitySize.y, densitySize.z, densitySize.x * densitySize.y * densitySize.z * 4 / 1024.f);
+        }
+        ImGui::SliderInt("Light map scale", &voxelizeShader->lightMapScale, 1, 8);
+        ImGui::Checkbox("Half float light depth", &voxelizeShader->halfDepth);
+        ImGui::Text("Light map : %d x %d", voxelizeShader->lightMapSize, voxelizeShader->lightMapSize);
+        ImGui::Checkbox("Region updates", &voxelizeShader->regionUpdates);
+        ImGui::Checkbox("Compute mips", &voxelizeShader->computeMips);
+        ImGui::Combo("Mip reduction", &voxelizeShader->mipShader->reduction, "Average\0Max\0Opacity\0");
+        glm::ivec3 dirtySize = glm::max(voxelizeShader->dirtyMax - voxelizeShader->dirtyMin, glm::ivec3(0));
+        ImGui::Text("Dirty region : %d x %d x %d", dirtySize.x, dirtySize.y, dirtySize.z);
+        ImGui::Checkbox("Sparse bricks", &volume->sparse);
+        if (volume->sparse) {
+            const BrickMap &bricks = volume->bricks;
+            ImGui::Text("Resident bricks : %d / %d", bricks.residentBricks, bricks.gridSize * bricks.gridSize * bricks.gridSize);
+            ImGui::Text("Last voxelize : %d allocated, %d freed%s", bricks.allocatedBricks, bricks.freedBricks, bricks.repacked ? ", repacked" : "");
+            ImGui::Text("Resident  : %.1f KB", bricks.residentBytes() / 1024.f);
+            ImGui::Text("Allocated : %.1f KB", bricks.atlasBytes() / 1024.f);
+            ImGui::Text("Dense     : %.1f KB (freed)", BrickMap::denseBytes(volume) / 1024.f);
+        }
+        ImGui::Checkbox("Octree cone trace", &volume->octree.enabled);
+        if (volume->octree.enabled) {
+            const SparseOctree &octree = volume->octree;
+            ImGui::Text("Octree : %d levels, %d nodes, %d fragments", octree.depth, octree.nodeCount, octree.fragmentCount);
+            ImGui::Text("Octree nodes : %.1f KB", octree.nodeBytes() / 1024.f);
+        }
+        ImGui::Checkbox("Clipmap cone trace", &volume->clipmap.enabled);
+        if (volume->clipmap.enabled) {
+            Clipmap &clipmap = volume->clipmap;
+            ImGui::SliderInt("Cascades", &clipmap.cascades, 1, Clipmap::MAX_CASCADES);
+            ImGui::Text("Clipmap extent : %.1f", clipmap.voxelSize(clipmap.cascades - 1) * clipmap.dimension);
+            ImGui::Text("Clipmap voxels updated : %d", clipmap.updatedVoxels);
+        }
+        if (ImGui::Button("Benchmark voxelize")) {
+            Benchmark::voxelize(voxelizeShader, volume);
+        }
+        ImGui::Text("Voxelize this frame : %s", !lightVoxelize ? "off" : voxelizeShader->ranThisFrame ? "ran" : "skipped");
+        ImGui::Text("Voxelize ran/skipped : %d / %d", voxelizeShader->runCount, voxelizeShader->skipCount);
         ImGui::Text("Voxels in scene : %d", voxelShader->activeVoxels);
+        static int readbackVoxels = 0;
+        if (ImGui::Button("Count voxels on CPU")) {
+            volume->requestReadback([](const uint8_t *voxels, int dim) {
+                readbackVoxels = 0;
+                for (int i = 0; i < dim * dim * dim; i++) {
+                    readbackVoxels += voxels[i] ? 1 : 0;
+                }
+            });
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Export volume")) {
+            volume->requestReadback([](const uint8_t *voxels, int dim) {
+                std::string name = "volume_" + std::to_string(dim) + ".r8";
+                std::ofstream file(name, std::ios::binary);
+                file.write((const char *) voxels, (std::streamsize)dim * dim * dim);
+                std::cout << "Exported " << name << std::endl;
+            });
+        }
+        ImGui::Text("CPU voxel count : %d (%d readbacks pending)", readbackVoxels, volume->pendingReadbacks());
         ImGui::Checkbox("Light view", &lightView);
         if (ImGui::Checkbox("Render voxels", &showVoxels)) {
             voxelShader->disableWhite = false;
@@ -275,7 +399,32 @@ void runImGuiPanes() {
 
     ImGui::Begin("VXGI");
     {
+        static int resolution = 0;
+        if (ImGui::Combo("Cloud resolution", &resolution, "Full\0Half\0Quarter\0")) {
+            coneShader->resolutionScale = 1 << resolution;
+        }
+        if (coneShader->resolutionScale > 1) {
+            ImGui::SliderFloat("Upsample sharpness", &coneShader->upsampler->depthSharpness, 0.f, 16.f);
+        }
+        ImGui::Checkbox("Temporal accumulation", &coneShader->temporal);
+        if (coneShader->temporal) {
+            ImGui::SliderFloat("History weight", &coneShader->historyWeight, 0.f, 0.98f);
+            ImGui::SliderFloat("History depth tolerance", &coneShader->depthTolerance, 0.f, 0.5f);
+        }
         ImGui::Checkbox("Cone trace", &coneShader->doConeTrace);
+        ImGui::Checkbox("Specialized shaders", &coneShader->specialize);
+        ImGui::Text("Cone trace programs : %d", coneShader->programCount());
+        ImGui::Checkbox("Lighting cache", &coneShader->cacheLighting);
+        if (coneShader->cacheLighting) {
+            ImGui::Text("Cache builds : %d", coneShader->cacheBuilds);
+        }
+        ImGui::Checkbox("Precomputed light", &volume->light.enabled);
+        if (volume->light.enabled) {
+            ImGui::SliderFloat("Extinction", &volume->light.extinction, 0.f, 4.f);
+            if (volume->sparse) {
+                ImGui::Text("Sparse volumes cone trace instead");
+            }
+        }
         ImGui::SliderInt("Steps", &coneShader->vctSteps, 1, 30);
         ImGui::SliderFloat("Angle", &coneShader->vctConeAngle, 0.f, 3.14f);
         ImGui::SliderFloat("Height", &coneShader->vctConeInitialHeight, 0.0f, 1.f);
@@ -289,7 +438,45 @@ void runImGuiPanes() {
         ImGui::Checkbox("Noise sample", &coneShader->doNoiseSample);
         ImGui::SliderFloat("Step size", &coneShader->stepSize, 0.001f, 1.f);
         ImGui::SliderFloat("Noise opacity", &coneShader->noiseOpacity, 0.1f, 40.f);
+        NoiseGenerator::Params &noiseParams = coneShader->noiseParams;
+        int basis = noiseParams.basis;
+        if (ImGui::Combo("Basis", &basis, "White\0Value\0Perlin\0Worley\0Curl\0")) {
+            noiseParams.basis = (NoiseGenerator::Basis) basis;
+        }
+        int noiseLog = 0;
+        while ((1 << noiseLog) < noiseParams.dimension) {
+            noiseLog++;
+        }
+        if (ImGui::SliderInt("Noise size (log2)", &noiseLog, 4, 8)) {
+            noiseParams.dimension = 1 << noiseLog;
+        }
+        if (noiseParams.basis != NoiseGenerator::WHITE) {
+            ImGui::SliderInt("Period", &noiseParams.period, 1, 32);
+        }
+        int seed = (int) noiseParams.seed;
+        if (ImGui::InputInt("Seed", &seed)) {
+            noiseParams.seed = (uint32_t) seed;
+        }
+        ImGui::Text("Noise map : %.2f ms (%s)", coneShader->noiseGenerateMs, coneShader->noiseFromCache ? "cached" : "generated");
+        ImGui::Checkbox("Disk cache", &coneShader->volumeCache.enabled);
+        ImGui::Text("Cache hits/misses : %d / %d", coneShader->volumeCache.hits, coneShader->volumeCache.misses);
+        int budgetMB = (int) (coneShader->volumeCache.budgetBytes >> 20);
+        if (ImGui::SliderInt("Cache budget (MB)", &budgetMB, 64, 4096)) {
+            coneShader->volumeCache.budgetBytes = (size_t) budgetMB << 20;
+        }
+        ImGui::Text("Cache size : %.1f MB, %d writes pending", coneShader->volumeCache.cachedBytes() / (1024.f * 1024.f), coneShader->volumeCache.pendingWrites());
+        if (ImGui::Button("Benchmark noise")) {
+            Benchmark::noise();
+        }
         ImGui::SliderInt("Octaves", &coneShader->numOctaves, 1, 10);
+        ImGui::Checkbox("Bake octaves", &coneShader->bakeNoise);
+        if (coneShader->bakeNoise) {
+            static int bakedLog = 7;
+            if (ImGui::SliderInt("Baked size (log2)", &bakedLog, 5, 8)) {
+                coneShader->bakedNoiseSize = 1 << bakedLog;
+            }
+            ImGui::Text("Bakes : %d", coneShader->noiseBakes);
+        }
         ImGui::SliderFloat("Frequency", &coneShader->freqStep, 0.01f, 10.f);
         ImGui::SliderFloat("Persistence", &coneShader->persStep, 0.01f, 1.f);
         ImGui::SliderFloat3("Wind Dir", glm::value_ptr(coneShader->windVel), -0.05f, 0.05f);